@@ -0,0 +1,166 @@
+#ifndef BENCHMARK_H
+#define BENCHMARK_H
+
+// General includes
+#include <stdio.h>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <functional>
+#include <chrono>
+
+// Bookkeeping for main.cpp's --bench sweep: timing trials, percentiles and the JSON report.
+// Everything is measured per particle, so runs with different particle counts compare directly.
+
+// Timing of one thing (a simulation step or a draw) at one particle count
+struct BenchResult {
+    std::string phase;          // "simulate" or "render"
+    std::string backend;        // "gpu" or "cpu"
+    std::string kernel;         // compute shader or CPU instruction set
+    std::string variant;        // which collisions were compiled in
+    size_t particles;
+    int stepsPerTrial;          // each trial times this many back to back, see timeTrials()
+    std::vector<double> nsPerParticle;  // one entry per trial, in the order they ran
+    double median, p95;         // of nsPerParticle
+};
+
+// Nearest-rank percentile, p in [0, 100]
+double percentile(std::vector<double> values, double p)
+{
+    if(values.empty())
+    {
+        return 0.0;
+    }
+    std::sort(values.begin(), values.end());
+    size_t rank = (size_t)(p / 100.0 * values.size() + 0.999999);
+    rank = std::max((size_t)1, std::min(rank, values.size()));
+    return values[rank - 1];
+}
+
+// Run batch() warmup times untimed, then trials times timed.
+// batch() has to block until its work is really done (glFinish() for GL work), the
+//  time is wall clock. Returns ns per particle per step for every timed trial
+std::vector<double> timeTrials(const std::function<void()> &batch, int warmup, int trials,
+                               size_t particles, int stepsPerTrial)
+{
+    for(int i = 0; i < warmup; i++)
+    {
+        batch();
+    }
+    std::vector<double> times;
+    for(int i = 0; i < trials; i++)
+    {
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        batch();
+        double ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+        times.push_back(ns / ((double)particles * stepsPerTrial));
+    }
+    return times;
+}
+
+class BenchReport {
+    public:
+        BenchReport()
+        : warmup(0), trials(0)
+        {}
+        // Describes the machine and settings, written once at the top of the JSON
+        void setInfo(const std::string &key, const std::string &value)
+        {
+            info.push_back(std::make_pair(key, value));
+        }
+        void setTrials(int warmupRuns, int timedRuns)
+        {
+            warmup = warmupRuns;
+            trials = timedRuns;
+        }
+        // Finish off a result (median, p95), keep it and print a line about it
+        void add(BenchResult result)
+        {
+            result.median = percentile(result.nsPerParticle, 50.0);
+            result.p95 = percentile(result.nsPerParticle, 95.0);
+            printf("%-8s %10zu  %-3s %-8s %-12s  median %8.3f ns/particle (%9.3e particles/s)  p95 %8.3f ns/particle\n",
+                   result.phase.c_str(), result.particles, result.backend.c_str(), result.kernel.c_str(),
+                   result.variant.c_str(), result.median, particlesPerSecond(result.median), result.p95);
+            fflush(stdout);
+            results.push_back(result);
+        }
+        // A size that couldn't be run at all still gets a record, so a missing entry
+        //  in a regression comparison is never silent
+        void skip(const std::string &backend, size_t particles, const std::string &reason)
+        {
+            printf("skipped  %10zu  %-3s %s\n", particles, backend.c_str(), reason.c_str());
+            skipped.push_back(std::make_pair(particles, backend + ": " + reason));
+        }
+        bool writeJSON(const char *path)
+        {
+            FILE *file = fopen(path, "w");
+            if(file == NULL)
+            {
+                fprintf(stderr, "Couldn't open %s for writing\n", path);
+                return false;
+            }
+            fprintf(file, "{\n");
+            for(size_t i = 0; i < info.size(); i++)
+            {
+                fprintf(file, "  \"%s\": \"%s\",\n", escape(info[i].first).c_str(), escape(info[i].second).c_str());
+            }
+            fprintf(file, "  \"warmup\": %d,\n  \"trials\": %d,\n", warmup, trials);
+            // p95 is of the time per particle, so the p95 throughput is the slow end
+            fprintf(file, "  \"results\": [");
+            for(size_t i = 0; i < results.size(); i++)
+            {
+                const BenchResult &r = results[i];
+                fprintf(file, "%s\n    {\"phase\": \"%s\", \"backend\": \"%s\", \"kernel\": \"%s\", \"variant\": \"%s\", "
+                        "\"particles\": %zu, \"steps_per_trial\": %d, "
+                        "\"median_ns_per_particle\": %.6g, \"p95_ns_per_particle\": %.6g, "
+                        "\"median_particles_per_s\": %.6g, \"p95_particles_per_s\": %.6g, \"trials_ns_per_particle\": [",
+                        i == 0 ? "" : ",", r.phase.c_str(), r.backend.c_str(), escape(r.kernel).c_str(), r.variant.c_str(),
+                        r.particles, r.stepsPerTrial, r.median, r.p95,
+                        particlesPerSecond(r.median), particlesPerSecond(r.p95));
+                for(size_t t = 0; t < r.nsPerParticle.size(); t++)
+                {
+                    fprintf(file, "%s%.6g", t == 0 ? "" : ", ", r.nsPerParticle[t]);
+                }
+                fprintf(file, "]}");
+            }
+            fprintf(file, "\n  ],\n  \"skipped\": [");
+            for(size_t i = 0; i < skipped.size(); i++)
+            {
+                fprintf(file, "%s\n    {\"particles\": %zu, \"reason\": \"%s\"}", i == 0 ? "" : ",",
+                        skipped[i].first, escape(skipped[i].second).c_str());
+            }
+            fprintf(file, "\n  ]\n}\n");
+            fclose(file);
+            return true;
+        }
+    private:
+        std::vector<std::pair<std::string, std::string> > info;
+        std::vector<BenchResult> results;
+        std::vector<std::pair<size_t, std::string> > skipped;
+        int warmup, trials;
+
+        static double particlesPerSecond(double nsPerParticle)
+        {
+            return nsPerParticle > 0.0 ? 1e9 / nsPerParticle : 0.0;
+        }
+        static std::string escape(const std::string &text)
+        {
+            // Renderer and driver strings are the only free text, quotes and
+            //  backslashes are all they're realistically going to contain
+            std::string out;
+            for(size_t i = 0; i < text.size(); i++)
+            {
+                if(text[i] == '"' || text[i] == '\\')
+                {
+                    out += '\\';
+                }
+                if((unsigned char)text[i] >= 0x20)
+                {
+                    out += text[i];
+                }
+            }
+            return out;
+        }
+};
+
+#endif
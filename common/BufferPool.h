@@ -0,0 +1,152 @@
+#ifndef BUFFERPOOL_H
+#define BUFFERPOOL_H
+
+// General includes
+#include <vector>
+#include <algorithm>
+
+// Opengl includes
+#include <GL/glew.h>
+
+// Capacity grows by at least this factor when a buffer has to be replaced, so
+//  growing the particle count a step at a time doesn't reallocate every step
+#define BUFFER_POOL_GROWTH 1.5
+
+// The particle buffers, one slot per buffer, and how much GPU memory they take.
+// reserve() keeps a slot's buffer whenever it's already big enough, including when the
+//  particle count shrinks, and only replaces it (deleting the old one) when it has to grow.
+// With GL 4.4 / ARB_buffer_storage the storage is immutable, which lets the driver
+//  place it once and skip the reallocation checks glBufferData buffers need.
+class BufferPool {
+    public:
+        BufferPool()
+        : currentBytes(0), peakBytes(0)
+        {}
+        // Flags for glBufferStorage, e.g. GL_MAP_READ_BIT | GL_MAP_WRITE_BIT for buffers
+        //  the CPU maps. Returns the slot
+        int addSlot(GLbitfield storageFlags)
+        {
+            Slot slot;
+            slot.buffer = 0;
+            slot.capacity = 0;
+            slot.flags = storageFlags;
+            slots.push_back(slot);
+            return (int)slots.size() - 1;
+        }
+        // Make sure the slot's buffer holds at least bytes and return it.
+        // A new buffer starts out undefined except for the first keepBytes, which are
+        //  copied over from the old one.
+        // If keeping anything and the new buffer can't be had, the old one stays, check
+        //  getCapacity() to find out
+        GLuint reserve(int slotIndex, GLsizeiptr bytes, GLsizeiptr keepBytes = 0)
+        {
+            Slot &slot = slots[slotIndex];
+            if(slot.buffer != 0 && slot.capacity >= bytes)
+            {
+                return slot.buffer;
+            }
+            GLsizeiptr capacity = std::max(bytes, (GLsizeiptr)(slot.capacity * BUFFER_POOL_GROWTH));
+            Slot old = slot;
+            if(keepBytes == 0 || old.buffer == 0)
+            {
+                // Free first, so the old and new buffer never have to fit at the same time
+                release(slotIndex);
+                old.buffer = 0;
+            }
+            slot.buffer = 0;
+            slot.capacity = 0;
+            if(!allocate(slot, capacity) && capacity > bytes)
+            {
+                // The headroom didn't fit, exactly what was asked for still might.
+                // Only that one's GL_OUT_OF_MEMORY matters to the caller
+                glGetError();
+                allocate(slot, bytes);
+            }
+            currentBytes += slot.capacity;
+            peakBytes = std::max(peakBytes, currentBytes);
+            if(old.buffer != 0)
+            {
+                if(slot.capacity < bytes)
+                {
+                    // Better the old buffer than none
+                    release(slotIndex);
+                    slot = old;
+                    return slot.buffer;
+                }
+                glBindBuffer(GL_COPY_READ_BUFFER, old.buffer);
+                glBindBuffer(GL_COPY_WRITE_BUFFER, slot.buffer);
+                glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, 0, std::min(keepBytes, old.capacity));
+                glDeleteBuffers(1, &old.buffer);
+                currentBytes -= old.capacity;
+            }
+            return slot.buffer;
+        }
+        void release(int slotIndex)
+        {
+            Slot &slot = slots[slotIndex];
+            glDeleteBuffers(1, &slot.buffer);
+            currentBytes -= slot.capacity;
+            slot.buffer = 0;
+            slot.capacity = 0;
+        }
+        GLuint getBuffer(int slotIndex)
+        {
+            return slots[slotIndex].buffer;
+        }
+        GLsizeiptr getCapacity(int slotIndex)
+        {
+            return slots[slotIndex].capacity;
+        }
+        // Bytes allocated right now, and the most there ever was at once
+        GLsizeiptr getCurrentBytes()
+        {
+            return currentBytes;
+        }
+        GLsizeiptr getPeakBytes()
+        {
+            return peakBytes;
+        }
+    private:
+        struct Slot {
+            GLuint buffer;
+            GLsizeiptr capacity;
+            GLbitfield flags;
+        };
+        std::vector<Slot> slots;
+        GLsizeiptr currentBytes, peakBytes;
+
+        bool allocate(Slot &slot, GLsizeiptr bytes)
+        {
+            if(slot.buffer != 0 && GLEW_ARB_buffer_storage)
+            {
+                // Immutable storage can't be respecified, a failed attempt needs a new name
+                glDeleteBuffers(1, &slot.buffer);
+                slot.buffer = 0;
+            }
+            if(slot.buffer == 0)
+            {
+                glGenBuffers(1, &slot.buffer);
+            }
+            glBindBuffer(GL_COPY_WRITE_BUFFER, slot.buffer);
+            if(GLEW_ARB_buffer_storage)
+            {
+                glBufferStorage(GL_COPY_WRITE_BUFFER, bytes, NULL, slot.flags);
+            }
+            else
+            {
+                glBufferData(GL_COPY_WRITE_BUFFER, bytes, NULL, GL_DYNAMIC_COPY);
+            }
+            // Ask rather than assume, an allocation that ran out of memory has no storage
+            //  (the GL_OUT_OF_MEMORY is left for the caller to find)
+            GLint64 allocated = 0;
+            glGetBufferParameteri64v(GL_COPY_WRITE_BUFFER, GL_BUFFER_SIZE, &allocated);
+            slot.capacity = (GLsizeiptr)allocated;
+            return slot.capacity >= bytes;
+        }
+
+        // Owns buffer objects
+        BufferPool(const BufferPool &);
+        BufferPool &operator=(const BufferPool &);
+};
+
+#endif
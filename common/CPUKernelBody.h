@@ -0,0 +1,128 @@
+// SIMD body of the CPU particle step. No include guard on purpose:
+// CPUKernels.h includes this once per instruction set, each time inside a namespace
+//  that defines a matching Ops struct and under a "#pragma GCC target" for that set.
+// Everything here must only talk to the hardware through Ops.
+
+// e^x for x <= 0, which is all the color scale ever needs
+// Cephes style: split x into n*ln(2) + r, polynomial for e^r, then scale by 2^n
+static Ops::vec expNegative(Ops::vec x)
+{
+    x = Ops::max(x, Ops::set1(-87.0f));
+    Ops::vec n = Ops::round(Ops::mul(x, Ops::set1(1.44269504088896341f)));
+    Ops::vec r = Ops::sub(x, Ops::mul(n, Ops::set1(0.693359375f)));
+    r = Ops::sub(r, Ops::mul(n, Ops::set1(-2.12194440e-4f)));
+
+    Ops::vec y = Ops::set1(1.9875691500e-4f);
+    y = Ops::fmadd(y, r, Ops::set1(1.3981999507e-3f));
+    y = Ops::fmadd(y, r, Ops::set1(8.3334519073e-3f));
+    y = Ops::fmadd(y, r, Ops::set1(4.1665795894e-2f));
+    y = Ops::fmadd(y, r, Ops::set1(1.6666665459e-1f));
+    y = Ops::fmadd(y, r, Ops::set1(5.0000001201e-1f));
+    y = Ops::fmadd(y, Ops::mul(r, r), Ops::add(r, Ops::set1(1.0f)));
+
+    return Ops::mul(y, Ops::pow2n(n));
+}
+
+// accelTowardsBH() from compute.glsl, added onto ax/ay/az
+static void accumulateAccel(Ops::vec px, Ops::vec py, Ops::vec pz,
+                            const glm::vec3 &bhPos, Ops::vec blackHoleAccel,
+                            Ops::vec &ax, Ops::vec &ay, Ops::vec &az)
+{
+    Ops::vec dx = Ops::sub(Ops::set1(bhPos.x), px);
+    Ops::vec dy = Ops::sub(Ops::set1(bhPos.y), py);
+    Ops::vec dz = Ops::sub(Ops::set1(bhPos.z), pz);
+    Ops::vec r = Ops::sqrt(Ops::fmadd(dx, dx, Ops::fmadd(dy, dy, Ops::mul(dz, dz))));
+    Ops::vec f = Ops::div(blackHoleAccel, Ops::mul(Ops::mul(r, r), r));
+    ax = Ops::fmadd(dx, f, ax);
+    ay = Ops::fmadd(dy, f, ay);
+    az = Ops::fmadd(dz, f, az);
+}
+
+// One step for every particle in [begin, end), Ops::width particles at a time.
+// Every ParticleStore column is one load per register, begin has to be a multiple of
+//  PARTICLE_STORE_PAD for the aligned loads.
+// Whatever doesn't fill a whole register is left to the scalar kernel.
+// Collisions are template parameters like in stepParticlesScalar(), so a disabled one
+//  costs nothing in the loop
+template<bool SphereEnable, bool FloorEnable>
+void stepParticles(ParticleStore &store, size_t begin, size_t end, const SimParams &params)
+{
+    const size_t W = Ops::width;
+    float signDT = (params.DT > 0.0f) - (params.DT < 0.0f);
+    // the sphere test compares squared distances, a radius <= 0 contains nothing
+    float sphereR2 = params.sphere.w > 0.0f ? params.sphere.w * params.sphere.w : -1.0f;
+
+    Ops::vec DT = Ops::set1(params.DT);
+    Ops::vec halfDT2 = Ops::set1(0.5f * params.DT * params.DT * signDT);
+    Ops::vec blackHoleAccel = Ops::set1(params.blackHoleAccel);
+    Ops::vec sx = Ops::set1(params.sphere.x);
+    Ops::vec sy = Ops::set1(params.sphere.y);
+    Ops::vec sz = Ops::set1(params.sphere.z);
+    Ops::vec r2 = Ops::set1(sphereR2);
+    Ops::vec edge = Ops::set1(params.sphere.w - 1.0f);
+    Ops::vec floorY = Ops::set1(params.floorPos);
+    Ops::vec aboveFloor = Ops::set1(params.floorPos + 1.0f);
+    Ops::vec negColorScale = Ops::set1(-params.colorScale);
+    Ops::vec zero = Ops::set1(0.0f);
+    Ops::vec one = Ops::set1(1.0f);
+
+    float *pxPtr = store.column(ParticleStore::PX), *pyPtr = store.column(ParticleStore::PY), *pzPtr = store.column(ParticleStore::PZ);
+    float *vxPtr = store.column(ParticleStore::VX), *vyPtr = store.column(ParticleStore::VY), *vzPtr = store.column(ParticleStore::VZ);
+    float *crPtr = store.column(ParticleStore::CR), *cgPtr = store.column(ParticleStore::CG), *cbPtr = store.column(ParticleStore::CB);
+
+    size_t i = begin;
+    for(; i + W <= end; i += W)
+    {
+        Ops::vec px = Ops::load(pxPtr + i), py = Ops::load(pyPtr + i), pz = Ops::load(pzPtr + i);
+        Ops::vec vx = Ops::load(vxPtr + i), vy = Ops::load(vyPtr + i), vz = Ops::load(vzPtr + i);
+
+        Ops::vec ax = zero, ay = zero, az = zero;
+        accumulateAccel(px, py, pz, params.blackHole1, blackHoleAccel, ax, ay, az);
+        accumulateAccel(px, py, pz, params.blackHole2, blackHoleAccel, ax, ay, az);
+
+        // Verlet
+        Ops::vec ppx = Ops::fmadd(ax, halfDT2, Ops::fmadd(vx, DT, px));
+        Ops::vec ppy = Ops::fmadd(ay, halfDT2, Ops::fmadd(vy, DT, py));
+        Ops::vec ppz = Ops::fmadd(az, halfDT2, Ops::fmadd(vz, DT, pz));
+        Ops::vec vpx = Ops::fmadd(ax, DT, vx);
+        Ops::vec vpy = Ops::fmadd(ay, DT, vy);
+        Ops::vec vpz = Ops::fmadd(az, DT, vz);
+
+        if(SphereEnable)
+        {
+            // Everything is computed for every lane, the mask picks who actually hit the sphere
+            Ops::vec dx = Ops::sub(ppx, sx);
+            Ops::vec dy = Ops::sub(ppy, sy);
+            Ops::vec dz = Ops::sub(ppz, sz);
+            Ops::mask outside = Ops::cmpnlt(Ops::fmadd(dx, dx, Ops::fmadd(dy, dy, Ops::mul(dz, dz))), r2);
+
+            Ops::vec len = Ops::sqrt(Ops::fmadd(ppx, ppx, Ops::fmadd(ppy, ppy, Ops::mul(ppz, ppz))));
+            Ops::vec toEdge = Ops::div(edge, len);
+            ppx = Ops::select(outside, Ops::fmadd(ppx, toEdge, sx), ppx);
+            ppy = Ops::select(outside, Ops::fmadd(ppy, toEdge, sy), ppy);
+            ppz = Ops::select(outside, Ops::fmadd(ppz, toEdge, sz), ppz);
+            vpx = Ops::select(outside, zero, vpx);
+            vpy = Ops::select(outside, zero, vpy);
+            vpz = Ops::select(outside, zero, vpz);
+        }
+        if(FloorEnable)
+        {
+            Ops::mask below = Ops::cmplt(ppy, floorY);
+            ppy = Ops::select(below, aboveFloor, ppy);
+            vpy = Ops::select(below, Ops::sub(zero, vpy), vpy);
+        }
+
+        // (1-e^(-kx)) color blend, same as the shader
+        Ops::vec speed = Ops::sqrt(Ops::fmadd(vpx, vpx, Ops::fmadd(vpy, vpy, Ops::mul(vpz, vpz))));
+        Ops::vec scale = Ops::sub(one, expNegative(Ops::mul(speed, negColorScale)));
+        Ops::vec cr = Ops::fmadd(Ops::set1(params.endColor.r - params.startColor.r), scale, Ops::set1(params.startColor.r));
+        Ops::vec cg = Ops::fmadd(Ops::set1(params.endColor.g - params.startColor.g), scale, Ops::set1(params.startColor.g));
+        Ops::vec cb = Ops::fmadd(Ops::set1(params.endColor.b - params.startColor.b), scale, Ops::set1(params.startColor.b));
+
+        Ops::store(pxPtr + i, ppx); Ops::store(pyPtr + i, ppy); Ops::store(pzPtr + i, ppz);
+        Ops::store(vxPtr + i, vpx); Ops::store(vyPtr + i, vpy); Ops::store(vzPtr + i, vpz);
+        Ops::store(crPtr + i, cr); Ops::store(cgPtr + i, cg); Ops::store(cbPtr + i, cb);
+    }
+
+    stepParticlesScalar<SphereEnable, FloorEnable>(store, i, end, params);
+}
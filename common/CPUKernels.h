@@ -0,0 +1,245 @@
+#ifndef CPUKERNELS_H
+#define CPUKERNELS_H
+
+// General includes
+#include <math.h>
+#include <stddef.h>
+#include <immintrin.h>
+
+// Opengl includes
+#include <glm/glm.hpp>
+
+// Project-specific includes
+#include "ParticleStore.h"
+
+// Everything the compute shader gets through uniforms, in one place.
+// main() fills one of these per frame and hands it to whichever backend is active
+struct SimParams {
+    glm::vec3 blackHole1;       //xyz position
+    glm::vec3 blackHole2;
+    glm::vec4 sphere;           //xyz position, w radius
+    glm::vec3 startColor;
+    glm::vec3 endColor;
+    float blackHoleAccel;
+    float DT;
+    float colorScale;
+    float floorPos;
+    int sphereEnable;           // picks the kernel variant, see selectParticleKernel()
+    int floorEnable;
+};
+
+// Signature every CPU kernel shares, steps particles [begin, end) of the store
+typedef void (*ParticleKernel)(ParticleStore &store, size_t begin, size_t end, const SimParams &params);
+
+// Instruction sets there's a kernel for, slowest to fastest
+enum KernelISA { ISA_SCALAR, ISA_SSE42, ISA_AVX2, ISA_AVX512, ISA_COUNT };
+
+// Plain C++ version of shaders/compute.glsl, one particle at a time.
+// Also handles whatever is left over at the end of a range for the SIMD kernels.
+// Like the shader, collisions are compiled in or out instead of being checked per particle
+template<bool SphereEnable, bool FloorEnable>
+void stepParticlesScalar(ParticleStore &store, size_t begin, size_t end, const SimParams &params)
+{
+    // used in color picking
+    const float e = 2.7182818284f;
+    // GLSL sign(), DT is the same for every particle so only do it once
+    float signDT = (params.DT > 0.0f) - (params.DT < 0.0f);
+    float DT = params.DT;
+    glm::vec3 spherePos = glm::vec3(params.sphere);
+    float *px = store.column(ParticleStore::PX), *py = store.column(ParticleStore::PY), *pz = store.column(ParticleStore::PZ);
+    float *vx = store.column(ParticleStore::VX), *vy = store.column(ParticleStore::VY), *vz = store.column(ParticleStore::VZ);
+    float *cr = store.column(ParticleStore::CR), *cg = store.column(ParticleStore::CG), *cb = store.column(ParticleStore::CB);
+
+    for(size_t i = begin; i < end; i++)
+    {
+        glm::vec3 p = glm::vec3(px[i], py[i], pz[i]);
+        glm::vec3 v = glm::vec3(vx[i], vy[i], vz[i]);
+
+        // Same math as compute.glsl, see the comments over there
+        glm::vec3 accelVec = glm::vec3(0.0f, 0.0f, 0.0f);
+        glm::vec3 bhPos[2] = { params.blackHole1, params.blackHole2 };
+        for(int bh = 0; bh < 2; bh++)
+        {
+            //norm(direction) * (G*m*M)/(r*r)
+            glm::vec3 dir = bhPos[bh] - p;
+            float r = glm::length(dir);
+            accelVec += params.blackHoleAccel * dir / (r*r*r);
+        }
+
+        glm::vec3 pp = p + v*DT + 0.5f*DT*DT*accelVec*signDT;
+        glm::vec3 vp = v + accelVec*DT;
+
+        if(SphereEnable && !(glm::length(pp - spherePos) < params.sphere.w))
+        {
+            pp = (glm::normalize(pp) * (params.sphere.w-1.0f)) + spherePos;
+            vp = glm::vec3(0.0f, 0.0f, 0.0f);
+        }
+        if(FloorEnable && pp.y < params.floorPos)
+        {
+            // reflect() over (0, 1, 0) only flips y
+            pp.y = params.floorPos+1.0f;
+            vp.y = -vp.y;
+        }
+
+        float scale = 1.0f - powf(e, -glm::length(vp)*params.colorScale);
+        glm::vec3 outColor = params.startColor - params.startColor*scale;
+        outColor += params.endColor*scale;
+
+        px[i] = pp.x; py[i] = pp.y; pz[i] = pp.z;
+        vx[i] = vp.x; vy[i] = vp.y; vz[i] = vp.z;
+        cr[i] = outColor.r; cg[i] = outColor.g; cb[i] = outColor.b;
+    }
+}
+
+// Each SIMD kernel is CPUKernelBody.h compiled against a different Ops struct.
+// The target pragmas let GCC use the instructions inside these functions only,
+//  the rest of the program still runs on any x86-64, selectParticleKernel() decides
+//  at runtime which ones are actually safe to call.
+#pragma GCC push_options
+#pragma GCC target("sse4.2")
+namespace sse42 {
+struct Ops {
+    typedef __m128 vec;
+    typedef __m128 mask;
+    static const int width = 4;
+    // ParticleStore columns are aligned and padded, so aligned loads are always fine
+    static vec set1(float f) { return _mm_set1_ps(f); }
+    static vec load(const float *p) { return _mm_load_ps(p); }
+    static void store(float *p, vec a) { _mm_store_ps(p, a); }
+    static vec add(vec a, vec b) { return _mm_add_ps(a, b); }
+    static vec sub(vec a, vec b) { return _mm_sub_ps(a, b); }
+    static vec mul(vec a, vec b) { return _mm_mul_ps(a, b); }
+    static vec div(vec a, vec b) { return _mm_div_ps(a, b); }
+    // no FMA before AVX2 machines
+    static vec fmadd(vec a, vec b, vec c) { return _mm_add_ps(_mm_mul_ps(a, b), c); }
+    static vec sqrt(vec a) { return _mm_sqrt_ps(a); }
+    static vec max(vec a, vec b) { return _mm_max_ps(a, b); }
+    static vec round(vec a) { return _mm_round_ps(a, _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC); }
+    static vec pow2n(vec n) { return _mm_castsi128_ps(_mm_slli_epi32(_mm_add_epi32(_mm_cvtps_epi32(n), _mm_set1_epi32(127)), 23)); }
+    static mask cmplt(vec a, vec b) { return _mm_cmplt_ps(a, b); }
+    static mask cmpnlt(vec a, vec b) { return _mm_cmpnlt_ps(a, b); }
+    static vec select(mask m, vec a, vec b) { return _mm_blendv_ps(b, a, m); }
+};
+#include "CPUKernelBody.h"
+}
+#pragma GCC pop_options
+
+#pragma GCC push_options
+#pragma GCC target("avx2,fma")
+namespace avx2 {
+struct Ops {
+    typedef __m256 vec;
+    typedef __m256 mask;
+    static const int width = 8;
+    static vec set1(float f) { return _mm256_set1_ps(f); }
+    static vec load(const float *p) { return _mm256_load_ps(p); }
+    static void store(float *p, vec a) { _mm256_store_ps(p, a); }
+    static vec add(vec a, vec b) { return _mm256_add_ps(a, b); }
+    static vec sub(vec a, vec b) { return _mm256_sub_ps(a, b); }
+    static vec mul(vec a, vec b) { return _mm256_mul_ps(a, b); }
+    static vec div(vec a, vec b) { return _mm256_div_ps(a, b); }
+    static vec fmadd(vec a, vec b, vec c) { return _mm256_fmadd_ps(a, b, c); }
+    static vec sqrt(vec a) { return _mm256_sqrt_ps(a); }
+    static vec max(vec a, vec b) { return _mm256_max_ps(a, b); }
+    static vec round(vec a) { return _mm256_round_ps(a, _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC); }
+    static vec pow2n(vec n) { return _mm256_castsi256_ps(_mm256_slli_epi32(_mm256_add_epi32(_mm256_cvtps_epi32(n), _mm256_set1_epi32(127)), 23)); }
+    static mask cmplt(vec a, vec b) { return _mm256_cmp_ps(a, b, _CMP_LT_OQ); }
+    static mask cmpnlt(vec a, vec b) { return _mm256_cmp_ps(a, b, _CMP_NLT_UQ); }
+    static vec select(mask m, vec a, vec b) { return _mm256_blendv_ps(b, a, m); }
+};
+#include "CPUKernelBody.h"
+}
+#pragma GCC pop_options
+
+#pragma GCC push_options
+#pragma GCC target("avx512f")
+// GCC 12's own AVX-512 headers trip these warnings when optimizing
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wmaybe-uninitialized"
+#pragma GCC diagnostic ignored "-Wuninitialized"
+namespace avx512 {
+struct Ops {
+    typedef __m512 vec;
+    typedef __mmask16 mask;
+    static const int width = 16;
+    static vec set1(float f) { return _mm512_set1_ps(f); }
+    static vec load(const float *p) { return _mm512_load_ps(p); }
+    static void store(float *p, vec a) { _mm512_store_ps(p, a); }
+    static vec add(vec a, vec b) { return _mm512_add_ps(a, b); }
+    static vec sub(vec a, vec b) { return _mm512_sub_ps(a, b); }
+    static vec mul(vec a, vec b) { return _mm512_mul_ps(a, b); }
+    static vec div(vec a, vec b) { return _mm512_div_ps(a, b); }
+    static vec fmadd(vec a, vec b, vec c) { return _mm512_fmadd_ps(a, b, c); }
+    static vec sqrt(vec a) { return _mm512_sqrt_ps(a); }
+    static vec max(vec a, vec b) { return _mm512_max_ps(a, b); }
+    static vec round(vec a) { return _mm512_roundscale_ps(a, _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC); }
+    static vec pow2n(vec n) { return _mm512_castsi512_ps(_mm512_slli_epi32(_mm512_add_epi32(_mm512_cvtps_epi32(n), _mm512_set1_epi32(127)), 23)); }
+    static mask cmplt(vec a, vec b) { return _mm512_cmp_ps_mask(a, b, _CMP_LT_OQ); }
+    static mask cmpnlt(vec a, vec b) { return _mm512_cmp_ps_mask(a, b, _CMP_NLT_UQ); }
+    static vec select(mask m, vec a, vec b) { return _mm512_mask_blend_ps(m, b, a); }
+};
+#include "CPUKernelBody.h"
+}
+#pragma GCC diagnostic pop
+#pragma GCC pop_options
+
+const char *kernelISAName(KernelISA isa)
+{
+    switch(isa)
+    {
+    case ISA_SSE42:
+        return "SSE4.2";
+    case ISA_AVX2:
+        return "AVX2";
+    case ISA_AVX512:
+        return "AVX-512";
+    default:
+        return "Scalar";
+    }
+}
+
+bool kernelISASupported(KernelISA isa)
+{
+    // CPUID check, GCC also makes sure the OS saves the wider registers
+    switch(isa)
+    {
+    case ISA_SSE42:
+        return __builtin_cpu_supports("sse4.2");
+    case ISA_AVX2:
+        return __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+    case ISA_AVX512:
+        return __builtin_cpu_supports("avx512f");
+    default:
+        return true;
+    }
+}
+
+KernelISA bestKernelISA()
+{
+    // Widest instruction set this CPU can run
+    int isa = ISA_COUNT - 1;
+    while(isa > ISA_SCALAR && !kernelISASupported((KernelISA)isa))
+    {
+        isa--;
+    }
+    return (KernelISA)isa;
+}
+
+ParticleKernel selectParticleKernel(KernelISA isa, bool sphereEnable, bool floorEnable)
+{
+    // Every instruction set has one kernel per sphere/floor combination,
+    //  indexed the same way as the compute shader variants in main.cpp
+    static const ParticleKernel kernels[ISA_COUNT][4] = {
+        { stepParticlesScalar<false, false>, stepParticlesScalar<true, false>,
+          stepParticlesScalar<false, true>, stepParticlesScalar<true, true> },
+        { sse42::stepParticles<false, false>, sse42::stepParticles<true, false>,
+          sse42::stepParticles<false, true>, sse42::stepParticles<true, true> },
+        { avx2::stepParticles<false, false>, avx2::stepParticles<true, false>,
+          avx2::stepParticles<false, true>, avx2::stepParticles<true, true> },
+        { avx512::stepParticles<false, false>, avx512::stepParticles<true, false>,
+          avx512::stepParticles<false, true>, avx512::stepParticles<true, true> },
+    };
+    return kernels[isa][(sphereEnable ? 1 : 0) | (floorEnable ? 2 : 0)];
+}
+
+#endif
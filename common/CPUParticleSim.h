@@ -0,0 +1,336 @@
+#ifndef CPUPARTICLESIM_H
+#define CPUPARTICLESIM_H
+
+// General includes
+#include <math.h>
+#include <vector>
+#include <algorithm>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <pthread.h>
+#include <sched.h>
+
+// Opengl includes
+#include <glm/glm.hpp>
+
+// Project-specific includes
+#include "ParticleStore.h"
+#include "CPUKernels.h"
+
+// Particles per kernel call inside a thread's chunk.
+// Small enough that the columns are still in L2 when the block gets packed for upload
+#define CPU_SIM_BLOCK 4096
+
+// Knobs for the CPU backend, see CPUParticleSim::init()
+struct CPUSimConfig {
+    int numThreads;             // <= 0 means one per core this process may run on
+    bool pinThreads;            // lock thread i to the i-th allowed core
+    HugePageMode hugePages;     // how ParticleStore should back its columns
+};
+
+// CPU version of shaders/compute.glsl
+// Particles are kept as a ParticleStore (one column per component) and only turned
+//  back into the SSBO vec4 layout when a step is written out for rendering.
+// The particle range is split into one contiguous chunk per thread. Worker threads
+//  are started once and then sleep on a condition variable between jobs,
+//  creating threads every frame costs more than the step itself at small counts.
+// Each chunk goes through the widest SIMD kernel the CPU supports (see CPUKernels.h)
+// Every job uses the same split of the padded particle range, so the thread that first
+//  touches a range of the store after resize() is the one that steps it from then on.
+//  With pinned threads that keeps each chunk on its thread's NUMA node.
+class CPUParticleSim {
+    public:
+        CPUParticleSim()
+        : numThreads(0), pinThreads(false), job(NULL), generation(0), pendingWorkers(0), quit(false)
+        {
+            setKernelISA(bestKernelISA());
+        }
+        ~CPUParticleSim()
+        {
+            stopWorkers();
+        }
+        void init(const CPUSimConfig &config)
+        {
+            // (Re)start the worker threads. The store is emptied, since its pages
+            //  belong to the old threads, so resize() and refill afterwards
+            // Waits for a job another thread is running on the pool to finish first
+            std::unique_lock<std::mutex> jobLock(jobMutex);
+            stopWorkers();
+            store.setHugePages(config.hugePages);
+            store.resize(0);
+
+            // Cores this process is allowed on, in order
+            allowedCPUs.clear();
+            cpu_set_t cpuSet;
+            CPU_ZERO(&cpuSet);
+            if(sched_getaffinity(0, sizeof(cpuSet), &cpuSet) == 0)
+            {
+                for(int cpu = 0; cpu < CPU_SETSIZE; cpu++)
+                {
+                    if(CPU_ISSET(cpu, &cpuSet))
+                    {
+                        allowedCPUs.push_back(cpu);
+                    }
+                }
+            }
+
+            numThreads = config.numThreads;
+            if(numThreads <= 0)
+            {
+                numThreads = allowedCPUs.empty() ? (int)std::thread::hardware_concurrency() : (int)allowedCPUs.size();
+            }
+            if(numThreads < 1)
+            {
+                numThreads = 1;
+            }
+            pinThreads = config.pinThreads && !allowedCPUs.empty();
+            // New workers start out having seen generation 0, so the count starts over
+            //  with them. Otherwise they'd take the old pool's last job for a new one
+            {
+                std::unique_lock<std::mutex> lock(poolMutex);
+                quit = false;
+                job = NULL;
+                generation = 0;
+                pendingWorkers = 0;
+            }
+            // Normally thread 0 is the caller of parallelFor(), so only numThreads-1 workers
+            //  are needed. The caller is the GL thread though, and pinning it would also
+            //  pin every thread the driver starts later, so when pinning every chunk
+            //  gets a worker of its own and the caller just waits
+            for(int i = pinThreads ? 0 : 1; i < numThreads; i++)
+            {
+                workers.push_back(std::thread(&CPUParticleSim::workerLoop, this, i));
+            }
+        }
+        void resize(size_t count)
+        {
+            // Nothing is physically allocated yet, let every thread fault in its own chunk
+            store.resize(count);
+            parallelFor([&](size_t begin, size_t end) {
+                store.touch(begin, end);
+            });
+        }
+        size_t size()
+        {
+            return store.size();
+        }
+        // Run fn over [0, count) split into one contiguous chunk per thread of the pool,
+        //  for work that isn't on the store (generating particles, say).
+        // Safe to call from any thread, jobs from different threads take turns.
+        // Before init() there are no workers and the calling thread does it all
+        void parallelRange(size_t count, const std::function<void(size_t, size_t)> &fn)
+        {
+            runOnEveryThread([&](int threadIndex) {
+                size_t chunks = std::max(numThreads, 1);
+                size_t begin = count * threadIndex / chunks;
+                size_t end = count * (threadIndex + 1) / chunks;
+                if(begin < end)
+                {
+                    fn(begin, end);
+                }
+            });
+        }
+        int getNumThreads()
+        {
+            return numThreads;
+        }
+        bool getPinThreads()
+        {
+            return pinThreads;
+        }
+        void setKernelISA(KernelISA isa)
+        {
+            // Fall back to the best supported set rather than crash on an illegal instruction
+            if(!kernelISASupported(isa))
+            {
+                isa = bestKernelISA();
+            }
+            kernelISA = isa;
+        }
+        KernelISA getKernelISA()
+        {
+            return kernelISA;
+        }
+        ParticleStore &getStore()
+        {
+            return store;
+        }
+        // Fill the store from the SSBO layout, e.g. the mapped buffers.
+        // The spans (one per SSBO shard) should cover every particle
+        void unpack(const std::vector<ParticleSpan> &spans)
+        {
+            parallelFor([&](size_t begin, size_t end) {
+                forEachSpan(spans, begin, end, [&](const ParticleSpan &span, size_t spanBegin, size_t spanEnd) {
+                    store.fromVec4(span, spanBegin, spanEnd);
+                });
+            });
+        }
+        // Same as unpack(), from the compact layout in CompactParticles.h
+        void unpackCompact(const std::vector<ParticleSpan> &spans, const glm::vec4 &box)
+        {
+            parallelFor([&](size_t begin, size_t end) {
+                forEachSpan(spans, begin, end, [&](const ParticleSpan &span, size_t spanBegin, size_t spanEnd) {
+                    store.fromCompact(span, box, spanBegin, spanEnd);
+                });
+            });
+        }
+        // Advance every particle one step.
+        // If output spans are given, each thread also packs its own chunk into them
+        //  (normally the mapped SSBOs) right after stepping it, while it's still in cache
+        void step(const SimParams &params, const std::vector<ParticleSpan> &outputs = std::vector<ParticleSpan>())
+        {
+            stepAndPack(params, [&](size_t begin, size_t end) {
+                forEachSpan(outputs, begin, end, [&](const ParticleSpan &span, size_t spanBegin, size_t spanEnd) {
+                    store.toVec4(span, spanBegin, spanEnd);
+                });
+            });
+        }
+        // Same as step(), packing into the compact layout
+        void stepCompact(const SimParams &params, const std::vector<ParticleSpan> &outputs, const glm::vec4 &box)
+        {
+            stepAndPack(params, [&](size_t begin, size_t end) {
+                forEachSpan(outputs, begin, end, [&](const ParticleSpan &span, size_t spanBegin, size_t spanEnd) {
+                    store.toCompact(span, box, spanBegin, spanEnd);
+                });
+            });
+        }
+    private:
+        ParticleStore store;
+        std::vector<std::thread> workers;
+        std::vector<int> allowedCPUs;
+        int numThreads;
+        bool pinThreads;
+        KernelISA kernelISA;
+
+        // Held for a whole job, or while init() replaces the workers
+        std::mutex jobMutex;
+        // Worker pool state, all guarded by poolMutex
+        std::mutex poolMutex;
+        std::condition_variable wakeWorkers, workersDone;
+        const std::function<void(int)> *job;        // called with the thread's index
+        unsigned long generation;
+        int pendingWorkers;
+        bool quit;
+
+        void stepAndPack(const SimParams &params, const std::function<void(size_t, size_t)> &pack)
+        {
+            size_t count = store.size();
+            // Collision flags only change when a checkbox is clicked, so they pick a
+            //  specialized kernel once per step instead of being tested per particle
+            ParticleKernel kernel = selectParticleKernel(kernelISA, params.sphereEnable == 1, params.floorEnable == 1);
+            // Kernels run over the padding too, that way every block is whole registers.
+            // pack() only sees real particles
+            parallelFor([&](size_t begin, size_t end) {
+                for(size_t block = begin; block < end; block += CPU_SIM_BLOCK)
+                {
+                    size_t blockEnd = std::min(block + CPU_SIM_BLOCK, end);
+                    kernel(store, block, blockEnd, params);
+                    if(block < count)
+                    {
+                        pack(block, std::min(blockEnd, count));
+                    }
+                }
+            });
+        }
+        void parallelFor(const std::function<void(size_t, size_t)> &fn)
+        {
+            // Run fn on every thread's chunk of the store's padded range
+            runOnEveryThread([&](int threadIndex) {
+                // Contiguous chunks keep each thread streaming through its own cache lines
+                size_t begin = chunkEdge(threadIndex);
+                size_t end = chunkEdge(threadIndex + 1);
+                if(begin < end)
+                {
+                    fn(begin, end);
+                }
+            });
+        }
+        void runOnEveryThread(const std::function<void(int)> &fn)
+        {
+            // Wake the workers, do our own share, then wait for everyone else
+            std::unique_lock<std::mutex> jobLock(jobMutex);
+            {
+                std::unique_lock<std::mutex> lock(poolMutex);
+                job = &fn;
+                pendingWorkers = (int)workers.size();
+                generation++;
+            }
+            wakeWorkers.notify_all();
+
+            if(!pinThreads)
+            {
+                fn(0);
+            }
+
+            std::unique_lock<std::mutex> lock(poolMutex);
+            workersDone.wait(lock, [this]{ return pendingWorkers == 0; });
+            job = NULL;
+        }
+        void stopWorkers()
+        {
+            {
+                std::unique_lock<std::mutex> lock(poolMutex);
+                quit = true;
+            }
+            wakeWorkers.notify_all();
+            for(size_t i = 0; i < workers.size(); i++)
+            {
+                workers[i].join();
+            }
+            workers.clear();
+        }
+        void pinCurrentThread(int threadIndex)
+        {
+            cpu_set_t cpuSet;
+            CPU_ZERO(&cpuSet);
+            CPU_SET(allowedCPUs[threadIndex % allowedCPUs.size()], &cpuSet);
+            pthread_setaffinity_np(pthread_self(), sizeof(cpuSet), &cpuSet);
+        }
+        void workerLoop(int threadIndex)
+        {
+            if(pinThreads)
+            {
+                pinCurrentThread(threadIndex);
+            }
+            unsigned long seenGeneration = 0;
+            while(true)
+            {
+                {
+                    std::unique_lock<std::mutex> lock(poolMutex);
+                    wakeWorkers.wait(lock, [&]{ return quit || generation != seenGeneration; });
+                    if(quit)
+                    {
+                        return;
+                    }
+                    seenGeneration = generation;
+                }
+                (*job)(threadIndex);
+                {
+                    std::unique_lock<std::mutex> lock(poolMutex);
+                    pendingWorkers--;
+                }
+                workersDone.notify_one();
+            }
+        }
+        size_t chunkEdge(int threadIndex)
+        {
+            // Chunk edges are rounded to PARTICLE_STORE_PAD particles, so every chunk
+            //  starts on an aligned register. Once there are several pages per thread
+            //  they're rounded to whole pages too, so no page is touched by two threads
+            size_t count = store.paddedSize();
+            if(threadIndex >= numThreads)
+            {
+                return count;
+            }
+            size_t align = PARTICLE_STORE_PAD;
+            if(count / numThreads >= 4 * store.pageParticles())
+            {
+                align = store.pageParticles();
+            }
+            return (count * threadIndex / numThreads) / align * align;
+        }
+};
+
+#endif
@@ -0,0 +1,67 @@
+#ifndef COLORLUT_H
+#define COLORLUT_H
+
+// General includes
+#include <vector>
+
+// Opengl includes
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+
+// Texels in the lookup table. vert.glsl gets the same number as a #define
+#define COLOR_LUT_SIZE 256
+
+// 1D texture that vert.glsl looks particle colors up in, when colors come from velocity
+//  instead of the Col SSBO. Entry t is the color at blend factor t = (1-e^(-kx)),
+//  so the shader only works out t from the velocity and does one texture fetch.
+// The table is only rewritten when the colors actually change.
+// Half floats, since the blend can go past 1 (startColor * 1.57, say) and compute.glsl
+//  doesn't clamp either
+class ColorLUT {
+    public:
+        ColorLUT()
+        : texture(0)
+        {}
+        // Needs a current context
+        void init()
+        {
+            glGenTextures(1, &texture);
+            glBindTexture(GL_TEXTURE_1D, texture);
+            glTexStorage1D(GL_TEXTURE_1D, 1, GL_RGBA16F, COLOR_LUT_SIZE);
+            glTexParameteri(GL_TEXTURE_1D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+            glTexParameteri(GL_TEXTURE_1D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+            glTexParameteri(GL_TEXTURE_1D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+            // Anything the table can't be equal to, so the first update() always writes
+            lastStart = lastEnd = glm::vec3(-1.0f);
+        }
+        // Blend from startColor at t = 0 to endColor at t = 1, same as compute.glsl
+        void update(const glm::vec3 &startColor, const glm::vec3 &endColor)
+        {
+            if(startColor == lastStart && endColor == lastEnd)
+            {
+                return;
+            }
+            lastStart = startColor;
+            lastEnd = endColor;
+
+            std::vector<glm::vec4> texels(COLOR_LUT_SIZE);
+            for(int i = 0; i < COLOR_LUT_SIZE; i++)
+            {
+                float t = (float)i / (COLOR_LUT_SIZE - 1);
+                texels[i] = glm::vec4(startColor - startColor*t + endColor*t, 1.0f);
+            }
+            // The driver converts to half floats
+            glBindTexture(GL_TEXTURE_1D, texture);
+            glTexSubImage1D(GL_TEXTURE_1D, 0, 0, COLOR_LUT_SIZE, GL_RGBA, GL_FLOAT, &texels[0]);
+        }
+        void bind(GLuint unit)
+        {
+            glActiveTexture(GL_TEXTURE0 + unit);
+            glBindTexture(GL_TEXTURE_1D, texture);
+        }
+    private:
+        GLuint texture;
+        glm::vec3 lastStart, lastEnd;
+};
+
+#endif
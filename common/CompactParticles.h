@@ -0,0 +1,140 @@
+#ifndef COMPACTPARTICLES_H
+#define COMPACTPARTICLES_H
+
+// General includes
+#include <string.h>
+#include <math.h>
+#include <algorithm>
+
+// Opengl includes
+#include <glm/glm.hpp>
+
+// Compact particle layout, the --compact storage mode.
+// Instead of a vec4 (16 B) each, a position and a velocity take 8 B:
+//  position: x, y, z as 16-bit fixed point across a cube around the bounding sphere,
+//            packed as (x | y << 16, z). The top half of the second word is unused
+//  velocity: x, y, z as half floats, packed like GLSL's packHalf2x16: (x | y << 16, z)
+// compute.glsl and vert.glsl decode/encode the same way when COMPACT_STORAGE is defined,
+//  these are the CPU side of it (initial upload and the CPU backend).
+// Fixed point has a constant step of 2 * halfExtent / 65535 everywhere in the cube, with the
+//  default 1000 sphere that's 0.06 units. Anything outside the cube is clamped to its faces.
+#define COMPACT_UINTS_PER_PARTICLE 2
+#define COMPACT_PARTICLE_BYTES (COMPACT_UINTS_PER_PARTICLE * 4)
+
+// The cube is centered on the sphere and this many radii from center to face,
+//  so there's room for particles when the sphere is switched off or the floor is below it
+#define COMPACT_EXTENT_SCALE 2.0f
+
+// Smallest radius the cube is sized for. The radius slider goes down to 0, and a cube
+//  of no size would have encodePosition() (and compact.glsl) divide by zero
+#define COMPACT_MIN_RADIUS 1.0f
+
+// xyz center, w half of the cube's side
+inline glm::vec4 compactBoxFor(const glm::vec4 &sphere)
+{
+    return glm::vec4(sphere.x, sphere.y, sphere.z, std::max(sphere.w, COMPACT_MIN_RADIUS) * COMPACT_EXTENT_SCALE);
+}
+
+// IEEE binary16 with round to nearest even, overflow goes to infinity
+inline unsigned int floatToHalf(float value)
+{
+    unsigned int bits;
+    memcpy(&bits, &value, sizeof(bits));
+    unsigned int sign = (bits >> 16) & 0x8000u;
+    unsigned int floatExponent = (bits >> 23) & 0xFFu;
+    unsigned int mantissa = bits & 0x7FFFFFu;
+    int exponent = (int)floatExponent - 127 + 15;
+    if(floatExponent == 0xFFu)
+    {
+        // Infinity stays infinity, NaN stays a (quiet) NaN
+        return sign | 0x7C00u | (mantissa ? 0x200u : 0u);
+    }
+    if(exponent >= 31)
+    {
+        return sign | 0x7C00u;
+    }
+    if(exponent <= 0)
+    {
+        // Denormal in half precision, or too small for it entirely
+        if(exponent < -10)
+        {
+            return sign;
+        }
+        mantissa |= 0x800000u;
+        unsigned int shift = (unsigned int)(14 - exponent);
+        unsigned int half = mantissa >> shift;
+        unsigned int rest = mantissa & ((1u << shift) - 1u);
+        unsigned int halfway = 1u << (shift - 1u);
+        if(rest > halfway || (rest == halfway && (half & 1u)))
+        {
+            half++;
+        }
+        return sign | half;
+    }
+    unsigned int half = sign | ((unsigned int)exponent << 10) | (mantissa >> 13);
+    unsigned int rest = mantissa & 0x1FFFu;
+    // A carry out of the mantissa bumps the exponent, which is exactly right (up to infinity)
+    if(rest > 0x1000u || (rest == 0x1000u && (half & 1u)))
+    {
+        half++;
+    }
+    return half;
+}
+
+inline float halfToFloat(unsigned int half)
+{
+    unsigned int sign = (half & 0x8000u) << 16;
+    unsigned int exponent = (half >> 10) & 0x1Fu;
+    unsigned int mantissa = half & 0x3FFu;
+    if(exponent == 0)
+    {
+        // Zero or denormal, mantissa * 2^-24
+        float value = ldexpf((float)mantissa, -24);
+        return sign ? -value : value;
+    }
+    unsigned int bits;
+    if(exponent == 31)
+    {
+        bits = sign | 0x7F800000u | (mantissa << 13);
+    }
+    else
+    {
+        bits = sign | ((exponent + 127 - 15) << 23) | (mantissa << 13);
+    }
+    float value;
+    memcpy(&value, &bits, sizeof(value));
+    return value;
+}
+
+inline void encodePosition(const glm::vec3 &position, const glm::vec4 &box, unsigned int *out)
+{
+    unsigned int q[3];
+    for(int c = 0; c < 3; c++)
+    {
+        float unit = (position[c] - box[c]) / box.w * 0.5f + 0.5f;
+        unit = unit < 0.0f ? 0.0f : (unit > 1.0f ? 1.0f : unit);
+        q[c] = (unsigned int)(unit * 65535.0f + 0.5f);
+    }
+    out[0] = q[0] | (q[1] << 16);
+    out[1] = q[2];
+}
+
+inline glm::vec3 decodePosition(const unsigned int *in, const glm::vec4 &box)
+{
+    glm::vec3 unit((float)(in[0] & 0xFFFFu), (float)(in[0] >> 16), (float)(in[1] & 0xFFFFu));
+    unit = unit / 65535.0f;
+    return glm::vec3(box.x, box.y, box.z) + (unit * 2.0f - 1.0f) * box.w;
+}
+
+inline void encodeVelocity(const glm::vec3 &velocity, unsigned int *out)
+{
+    out[0] = floatToHalf(velocity.x) | (floatToHalf(velocity.y) << 16);
+    out[1] = floatToHalf(velocity.z);
+}
+
+inline glm::vec3 decodeVelocity(const unsigned int *in)
+{
+    return glm::vec3(halfToFloat(in[0] & 0xFFFFu), halfToFloat(in[0] >> 16), halfToFloat(in[1] & 0xFFFFu));
+}
+
+#endif
@@ -0,0 +1,40 @@
+#ifndef COMPUTEDISPATCH_H
+#define COMPUTEDISPATCH_H
+
+// General includes
+#include <algorithm>
+
+// Opengl includes
+#include <GL/glew.h>
+
+// One invocation per particle, for any particle count.
+// GL only guarantees 65535 work groups per dimension, 6.5M particles at a local size of
+//  100. Past that the groups are tiled into rows of as many as X allows (then layers, in Z),
+//  and the shaders flatten gl_GlobalInvocationID back into a particle index with
+//  invocationIndex() from shaders/dispatch.glsl.
+// The grid is rounded up to whole groups (and whole rows), so the shaders also have to
+//  skip gid >= the particle count.
+inline void dispatchParticles(GLuint count, GLuint workGroupSize)
+{
+    // Limits can't change for a context, and there's only ever one
+    static GLint maxGroups[3] = {0, 0, 0};
+    if(maxGroups[0] == 0)
+    {
+        for(int i = 0; i < 3; i++)
+        {
+            glGetIntegeri_v(GL_MAX_COMPUTE_WORK_GROUP_COUNT, i, &maxGroups[i]);
+        }
+    }
+    GLuint groups = (count + workGroupSize - 1) / workGroupSize;
+    if(groups == 0)
+    {
+        return;
+    }
+    GLuint x = std::min(groups, (GLuint)maxGroups[0]);
+    GLuint rows = (groups + x - 1) / x;
+    GLuint y = std::min(rows, (GLuint)maxGroups[1]);
+    GLuint z = (rows + y - 1) / y;
+    glDispatchCompute(x, y, z);
+}
+
+#endif
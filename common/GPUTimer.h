@@ -0,0 +1,223 @@
+#ifndef GPUTIMER_H
+#define GPUTIMER_H
+
+// General includes
+#include <stdio.h>
+#include <vector>
+
+// Opengl includes
+#include <GL/glew.h>
+
+// Frames of query objects kept in flight. Results are read back this many frames after
+//  they were issued, by then the GPU is done with them and reading never waits
+#define GPU_TIMER_LATENCY 4
+// Samples kept per pass for the graphs
+#define GPU_TIMER_HISTORY 240
+
+// GPU time of each render pass, from GL_TIME_ELAPSED queries around the pass,
+//  plus the time between the starts of consecutive frames from GL_TIMESTAMP queries.
+// That frame time includes what no query can wrap, like the multisample resolve and
+//  the swap, so frame minus the sum of passes is whatever happens outside them.
+// Elapsed queries can't nest, passes have to be timed one after the other.
+class GPUTimer {
+    public:
+        GPUTimer()
+        : numPasses(0), openPass(-1), frame(0), historyPos(0), lastFrameStart(0), havePreviousFrame(false), droppedSamples(0), collectedFrames(0)
+        {}
+        // Needs a current context, passes are then numbered 0..passCount-1.
+        // The query objects live as long as the context, there's no destructor on purpose:
+        //  the timer is a global and outlives the context at exit
+        void init(int passCount)
+        {
+            release();
+            numPasses = passCount;
+            openPass = -1;
+            for(int slot = 0; slot < GPU_TIMER_LATENCY; slot++)
+            {
+                slots[slot].passQueries.resize(numPasses);
+                slots[slot].issued.assign(numPasses, false);
+                glGenQueries(numPasses, &slots[slot].passQueries[0]);
+                glGenQueries(1, &slots[slot].frameStartQuery);
+                slots[slot].frameIssued = false;
+            }
+            history.assign(numPasses + 1, std::vector<float>(GPU_TIMER_HISTORY, 0.0f));
+            historyPos = 0;
+            frame = 0;
+            havePreviousFrame = false;
+            droppedSamples = 0;
+            collectedFrames = 0;
+        }
+        // Call once at the start of every frame, before any pass
+        void beginFrame()
+        {
+            // This slot was last used GPU_TIMER_LATENCY frames ago, collect it before reuse
+            collect(frame % GPU_TIMER_LATENCY);
+            Slot &slot = slots[frame % GPU_TIMER_LATENCY];
+            slot.issued.assign(numPasses, false);
+            glQueryCounter(slot.frameStartQuery, GL_TIMESTAMP);
+            slot.frameIssued = true;
+        }
+        void begin(int pass)
+        {
+            if(openPass >= 0)
+            {
+                // A second elapsed query would just be a GL error, close the open one
+                fprintf(stderr, "GPU timer: pass %d began before pass %d ended\n", pass, openPass);
+                end(openPass);
+            }
+            Slot &slot = slots[frame % GPU_TIMER_LATENCY];
+            glBeginQuery(GL_TIME_ELAPSED, slot.passQueries[pass]);
+            slot.issued[pass] = true;
+            openPass = pass;
+        }
+        // Has to match the last begin()
+        void end(int pass)
+        {
+            if(pass != openPass)
+            {
+                fprintf(stderr, "GPU timer: end of pass %d, but the pass running is %d\n", pass, openPass);
+                if(openPass < 0)
+                {
+                    return;
+                }
+            }
+            glEndQuery(GL_TIME_ELAPSED);
+            openPass = -1;
+        }
+        // Call once at the end of every frame
+        void endFrame()
+        {
+            frame++;
+        }
+        // Rolling history in ms, oldest first when read from historyOffset().
+        // Pass numPasses is the whole frame
+        const float *getHistory(int pass)
+        {
+            return &history[pass][0];
+        }
+        int historyOffset()
+        {
+            return historyPos;
+        }
+        // Most recent sample in ms
+        float latest(int pass)
+        {
+            return history[pass][(historyPos + GPU_TIMER_HISTORY - 1) % GPU_TIMER_HISTORY];
+        }
+        // Mean over the whole history in ms, ignoring frames the pass didn't run in
+        float average(int pass)
+        {
+            float sum = 0.0f;
+            int count = 0;
+            for(int i = 0; i < GPU_TIMER_HISTORY; i++)
+            {
+                if(history[pass][i] > 0.0f)
+                {
+                    sum += history[pass][i];
+                    count++;
+                }
+            }
+            return count > 0 ? sum / count : 0.0f;
+        }
+        int getNumPasses()
+        {
+            return numPasses;
+        }
+        // Samples thrown away because the GPU was more than GPU_TIMER_LATENCY frames behind
+        int getDroppedSamples()
+        {
+            return droppedSamples;
+        }
+    private:
+        struct Slot {
+            std::vector<GLuint> passQueries;
+            std::vector<bool> issued;
+            GLuint frameStartQuery;
+            bool frameIssued;
+        };
+        Slot slots[GPU_TIMER_LATENCY];
+        int numPasses;
+        int openPass;                   // begun and not yet ended, -1 if none
+        unsigned long frame;
+        std::vector<std::vector<float> > history;
+        int historyPos;
+        GLuint64 lastFrameStart;
+        bool havePreviousFrame;
+        int droppedSamples;
+        unsigned long collectedFrames;
+
+        void collect(int slotIndex)
+        {
+            Slot &slot = slots[slotIndex];
+            if(!slot.frameIssued)
+            {
+                return;
+            }
+            slot.frameIssued = false;
+
+            // Check first, a query that isn't done yet is skipped rather than waited on
+            GLint available = 0;
+            glGetQueryObjectiv(slot.frameStartQuery, GL_QUERY_RESULT_AVAILABLE, &available);
+            for(int pass = 0; pass < numPasses && available; pass++)
+            {
+                GLint passAvailable = 1;
+                if(slot.issued[pass])
+                {
+                    glGetQueryObjectiv(slot.passQueries[pass], GL_QUERY_RESULT_AVAILABLE, &passAvailable);
+                }
+                available = passAvailable;
+            }
+            if(!available)
+            {
+                droppedSamples++;
+                havePreviousFrame = false;
+                return;
+            }
+
+            GLuint64 frameStart = 0;
+            glGetQueryObjectui64v(slot.frameStartQuery, GL_QUERY_RESULT, &frameStart);
+            if(collectedFrames++ == 0)
+            {
+                // The very first frame pays for driver warmup and lazy shader compiles
+                //  (and llvmpipe reports nonsense for it), keep it out of the graphs
+                lastFrameStart = frameStart;
+                havePreviousFrame = true;
+                return;
+            }
+
+            for(int pass = 0; pass < numPasses; pass++)
+            {
+                GLuint64 elapsed = 0;
+                if(slot.issued[pass])
+                {
+                    glGetQueryObjectui64v(slot.passQueries[pass], GL_QUERY_RESULT, &elapsed);
+                }
+                history[pass][historyPos] = elapsed * 1e-6f;
+            }
+            // The frame time is known once the next frame has started,
+            //  so it lags the passes by one sample
+            history[numPasses][historyPos] = havePreviousFrame ? (frameStart - lastFrameStart) * 1e-6f : 0.0f;
+            lastFrameStart = frameStart;
+            havePreviousFrame = true;
+            historyPos = (historyPos + 1) % GPU_TIMER_HISTORY;
+        }
+        void release()
+        {
+            if(numPasses == 0)
+            {
+                return;
+            }
+            for(int slot = 0; slot < GPU_TIMER_LATENCY; slot++)
+            {
+                glDeleteQueries(numPasses, &slots[slot].passQueries[0]);
+                glDeleteQueries(1, &slots[slot].frameStartQuery);
+            }
+            numPasses = 0;
+        }
+
+        // Owns GL query objects
+        GPUTimer(const GPUTimer &);
+        GPUTimer &operator=(const GPUTimer &);
+};
+
+#endif
@@ -0,0 +1,249 @@
+#ifndef HEADLESSCONTEXT_H
+#define HEADLESSCONTEXT_H
+
+// General includes
+#include <stdio.h>
+#include <vector>
+
+// Opengl includes
+#include <GL/glew.h>
+#ifdef USE_OSMESA
+#include <GL/osmesa.h>
+#else
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+#endif
+
+// OpenGL 4.3 core context with no window and no display server, for servers, containers and CI.
+// By default it's an EGL context on Mesa's surfaceless platform, which needs nothing but
+//  libEGL and a driver (llvmpipe works). Build with -DUSE_OSMESA -lOSMesa instead to
+//  get an OSMesa context, for Mesa builds without EGL.
+// There's no default framebuffer either way, so rendering goes into an FBO made here.
+class HeadlessContext {
+    public:
+        HeadlessContext()
+        : width(0), height(0), fbo(0), colorBuffer(0), depthBuffer(0)
+#ifdef USE_OSMESA
+          , context(NULL)
+#else
+          , display(EGL_NO_DISPLAY), context(EGL_NO_CONTEXT)
+#endif
+        {}
+        ~HeadlessContext()
+        {
+            destroy();
+        }
+        // Create the context, make it current and load GL functions.
+        // Returns false (after saying why) if any step fails
+        bool init(int fbWidth, int fbHeight)
+        {
+            width = fbWidth;
+            height = fbHeight;
+            if(!createContext())
+            {
+                return false;
+            }
+
+            // Necessary due to glew bug
+            glewExperimental = true;
+            GLenum glewResult = glewInit();
+#ifdef GLEW_ERROR_NO_GLX_DISPLAY
+            // GLEW built for GLX complains when there's no X display,
+            //  but it has already loaded every GL function by then
+            if(glewResult == GLEW_ERROR_NO_GLX_DISPLAY)
+            {
+                glewResult = GLEW_OK;
+            }
+#endif
+            if(glewResult != GLEW_OK)
+            {
+                fprintf(stderr, "Failed to initialize GLEW: %s\n", glewGetErrorString(glewResult));
+                return false;
+            }
+            printf("Headless %s context: %s, %s\n", getBackendName(),
+                   (const char *)glGetString(GL_RENDERER), (const char *)glGetString(GL_VERSION));
+            return createFramebuffer();
+        }
+        void destroy()
+        {
+            if(fbo != 0)
+            {
+                glDeleteFramebuffers(1, &fbo);
+                glDeleteRenderbuffers(1, &colorBuffer);
+                glDeleteRenderbuffers(1, &depthBuffer);
+                fbo = colorBuffer = depthBuffer = 0;
+            }
+#ifdef USE_OSMESA
+            if(context != NULL)
+            {
+                OSMesaDestroyContext(context);
+                context = NULL;
+            }
+#else
+            if(display != EGL_NO_DISPLAY)
+            {
+                eglMakeCurrent(display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+                if(context != EGL_NO_CONTEXT)
+                {
+                    eglDestroyContext(display, context);
+                }
+                eglTerminate(display);
+                display = EGL_NO_DISPLAY;
+                context = EGL_NO_CONTEXT;
+            }
+#endif
+        }
+        // Offscreen render target, bind it before drawing
+        GLuint getFramebuffer()
+        {
+            return fbo;
+        }
+        int getWidth()
+        {
+            return width;
+        }
+        int getHeight()
+        {
+            return height;
+        }
+        const char *getBackendName()
+        {
+#ifdef USE_OSMESA
+            return "OSMesa";
+#else
+            return "EGL surfaceless";
+#endif
+        }
+        // Write whatever is in the FBO to a binary PPM, mostly to check a run by eye
+        bool saveFrame(const char *path)
+        {
+            std::vector<unsigned char> pixels(width * height * 3);
+            glBindFramebuffer(GL_READ_FRAMEBUFFER, fbo);
+            glPixelStorei(GL_PACK_ALIGNMENT, 1);
+            glReadPixels(0, 0, width, height, GL_RGB, GL_UNSIGNED_BYTE, &pixels[0]);
+
+            FILE *file = fopen(path, "wb");
+            if(file == NULL)
+            {
+                fprintf(stderr, "Couldn't open %s for writing\n", path);
+                return false;
+            }
+            fprintf(file, "P6\n%d %d\n255\n", width, height);
+            // GL's rows start at the bottom, PPM's at the top
+            for(int row = height - 1; row >= 0; row--)
+            {
+                fwrite(&pixels[row * width * 3], 1, width * 3, file);
+            }
+            fclose(file);
+            return true;
+        }
+    private:
+        int width, height;
+        GLuint fbo, colorBuffer, depthBuffer;
+#ifdef USE_OSMESA
+        OSMesaContext context;
+        std::vector<unsigned char> osmesaBuffer;
+
+        bool createContext()
+        {
+            const int attribs[] = {
+                OSMESA_FORMAT, OSMESA_RGBA,
+                OSMESA_DEPTH_BITS, 24,
+                OSMESA_PROFILE, OSMESA_CORE_PROFILE,
+                OSMESA_CONTEXT_MAJOR_VERSION, 4,
+                OSMESA_CONTEXT_MINOR_VERSION, 3,
+                0
+            };
+            context = OSMesaCreateContextAttribs(attribs, NULL);
+            if(context == NULL)
+            {
+                fprintf(stderr, "Failed to create an OpenGL 4.3 OSMesa context\n");
+                return false;
+            }
+            // OSMesa always renders into client memory, even though nothing reads it.
+            // A 1x1 buffer is enough, the real target is the FBO
+            osmesaBuffer.resize(4);
+            if(!OSMesaMakeCurrent(context, &osmesaBuffer[0], GL_UNSIGNED_BYTE, 1, 1))
+            {
+                fprintf(stderr, "Failed to make the OSMesa context current\n");
+                return false;
+            }
+            return true;
+        }
+#else
+        EGLDisplay display;
+        EGLContext context;
+
+        bool createContext()
+        {
+            // The surfaceless platform is an extension, so the entry point has to be looked up
+            PFNEGLGETPLATFORMDISPLAYEXTPROC getPlatformDisplay =
+                (PFNEGLGETPLATFORMDISPLAYEXTPROC)eglGetProcAddress("eglGetPlatformDisplayEXT");
+            if(getPlatformDisplay == NULL)
+            {
+                fprintf(stderr, "EGL has no eglGetPlatformDisplayEXT, can't run headless\n");
+                return false;
+            }
+            display = getPlatformDisplay(EGL_PLATFORM_SURFACELESS_MESA, EGL_DEFAULT_DISPLAY, NULL);
+            EGLint major, minor;
+            if(display == EGL_NO_DISPLAY || !eglInitialize(display, &major, &minor))
+            {
+                fprintf(stderr, "Failed to initialize a surfaceless EGL display\n");
+                display = EGL_NO_DISPLAY;
+                return false;
+            }
+            if(!eglBindAPI(EGL_OPENGL_API))
+            {
+                fprintf(stderr, "EGL can't do desktop OpenGL on this system\n");
+                return false;
+            }
+            // Same version and profile initWindow() asks GLFW for
+            const EGLint attribs[] = {
+                EGL_CONTEXT_MAJOR_VERSION, 4,
+                EGL_CONTEXT_MINOR_VERSION, 3,
+                EGL_CONTEXT_OPENGL_PROFILE_MASK, EGL_CONTEXT_OPENGL_CORE_PROFILE_BIT,
+                EGL_NONE
+            };
+            // No surface means no config is needed either (EGL_KHR_no_config_context)
+            context = eglCreateContext(display, EGL_NO_CONFIG_KHR, EGL_NO_CONTEXT, attribs);
+            if(context == EGL_NO_CONTEXT)
+            {
+                fprintf(stderr, "Failed to create an OpenGL 4.3 EGL context\n");
+                return false;
+            }
+            if(!eglMakeCurrent(display, EGL_NO_SURFACE, EGL_NO_SURFACE, context))
+            {
+                fprintf(stderr, "Failed to make the EGL context current\n");
+                return false;
+            }
+            return true;
+        }
+#endif
+        bool createFramebuffer()
+        {
+            glGenRenderbuffers(1, &colorBuffer);
+            glBindRenderbuffer(GL_RENDERBUFFER, colorBuffer);
+            glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, width, height);
+            glGenRenderbuffers(1, &depthBuffer);
+            glBindRenderbuffer(GL_RENDERBUFFER, depthBuffer);
+            glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, width, height);
+
+            glGenFramebuffers(1, &fbo);
+            glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+            glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, colorBuffer);
+            glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, depthBuffer);
+            if(glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+            {
+                fprintf(stderr, "Offscreen framebuffer is incomplete\n");
+                return false;
+            }
+            glViewport(0, 0, width, height);
+            return true;
+        }
+
+        // Owns the context, copies would destroy it twice
+        HeadlessContext(const HeadlessContext &);
+        HeadlessContext &operator=(const HeadlessContext &);
+};
+
+#endif
@@ -0,0 +1,333 @@
+#ifndef INITIALCONDITIONS_H
+#define INITIALCONDITIONS_H
+
+// General includes
+#include <math.h>
+#include <stdint.h>
+#include <string.h>
+#include <vector>
+#include <thread>
+#include <functional>
+#include <algorithm>
+
+// Opengl includes
+#include <glm/glm.hpp>
+
+// Project-specific includes
+#include "CPUParticleSim.h"
+
+// Starting positions and velocities for the particles.
+// Every particle's randomness comes from a counter-based RNG (Philox4x32-10) keyed by the
+//  seed, with the particle index as the counter. A particle doesn't depend on any other,
+//  so the particles can be generated in any order on any number of threads and always
+//  come out the same for the same seed.
+
+// Philox4x32-10 (Salmon et al., "Parallel random numbers: as easy as 1, 2, 3", SC11).
+// Hashes a 128-bit counter with a 64-bit key into 128 random bits
+#define PHILOX_M0 0xD2511F53u
+#define PHILOX_M1 0xCD9E8D57u
+#define PHILOX_W0 0x9E3779B9u
+#define PHILOX_W1 0xBB67AE85u
+#define PHILOX_ROUNDS 10
+
+inline void philox4x32(const uint32_t counter[4], const uint32_t key[2], uint32_t out[4])
+{
+    uint32_t c0 = counter[0], c1 = counter[1], c2 = counter[2], c3 = counter[3];
+    uint32_t k0 = key[0], k1 = key[1];
+    for(int round = 0; round < PHILOX_ROUNDS; round++)
+    {
+        uint64_t product0 = (uint64_t)PHILOX_M0 * c0;
+        uint64_t product1 = (uint64_t)PHILOX_M1 * c2;
+        uint32_t hi0 = (uint32_t)(product0 >> 32), lo0 = (uint32_t)product0;
+        uint32_t hi1 = (uint32_t)(product1 >> 32), lo1 = (uint32_t)product1;
+        c0 = hi1 ^ c1 ^ k0;
+        c1 = lo1;
+        c2 = hi0 ^ c3 ^ k1;
+        c3 = lo0;
+        k0 += PHILOX_W0;
+        k1 += PHILOX_W1;
+    }
+    out[0] = c0; out[1] = c1; out[2] = c2; out[3] = c3;
+}
+
+// The random numbers of one particle: counter = (index, draw block), key = seed.
+// Hands out 4 numbers per Philox call
+class ParticleRandom {
+    public:
+        ParticleRandom(uint32_t seed, uint64_t index)
+        : block(0), used(4)
+        {
+            key[0] = seed;
+            key[1] = 0x5EED5EEDu;
+            counter[0] = (uint32_t)index;
+            counter[1] = (uint32_t)(index >> 32);
+        }
+        uint32_t next()
+        {
+            if(used == 4)
+            {
+                counter[2] = block++;
+                counter[3] = 0;
+                philox4x32(counter, key, bits);
+                used = 0;
+            }
+            return bits[used++];
+        }
+        // In (0, 1), never exactly 0 or 1, so log() and 1/x are always safe
+        float uniform()
+        {
+            return ((next() >> 8) + 0.5f) * (1.0f / 16777216.0f);
+        }
+        float between(float a, float b)
+        {
+            return a + (b - a) * uniform();
+        }
+        // Standard normal, Box-Muller
+        float normal()
+        {
+            float r = sqrtf(-2.0f * logf(uniform()));
+            return r * cosf(6.2831853f * uniform());
+        }
+        // Uniform on the unit sphere's surface
+        glm::vec3 direction()
+        {
+            float z = between(-1.0f, 1.0f);
+            float phi = 6.2831853f * uniform();
+            float r = sqrtf(std::max(0.0f, 1.0f - z * z));
+            return glm::vec3(r * cosf(phi), r * sinf(phi), z);
+        }
+    private:
+        uint32_t key[2], counter[4], bits[4];
+        uint32_t block;
+        int used;
+};
+
+// What the particles start out as
+//  DIST_BALL:          uniform in a ball, random velocities. The original setup
+//  DIST_SHELL:         uniform on a thin spherical shell, random velocities
+//  DIST_PLUMMER:       Plummer sphere, isotropic velocities from its distribution function
+//  DIST_DISK:          exponential disk in the XZ plane, rotating around the center
+//  DIST_TWO_GALAXIES:  two such disks on a collision course, one of them tilted
+enum Distribution { DIST_BALL, DIST_SHELL, DIST_PLUMMER, DIST_DISK, DIST_TWO_GALAXIES, DIST_COUNT };
+
+inline const char *distributionName(Distribution distribution)
+{
+    const char *names[DIST_COUNT] = {"ball", "shell", "plummer", "disk", "galaxies"};
+    return names[distribution];
+}
+
+struct InitialConditions {
+    Distribution distribution;
+    uint32_t seed;
+    float radius;           // ball/shell radius, Plummer scale radius, disk scale length
+    float speed;            // ball/shell: largest random speed, Plummer: velocity scale,
+                            //  disks: random speed added on top of the rotation
+    float centralAccel;     // G*M that disks orbit (the sim's blackHoleAccel units)
+    float separation;       // two galaxies: distance between the centers
+    float approachSpeed;    // two galaxies: speed they close in on each other with
+};
+
+// Reasonable settings for each distribution at the default sphere size
+inline InitialConditions defaultInitialConditions(Distribution distribution)
+{
+    InitialConditions ic;
+    ic.distribution = distribution;
+    ic.seed = 1;
+    ic.centralAccel = 50.0f;
+    ic.separation = 600.0f;
+    ic.approachSpeed = 0.3f;
+    switch(distribution)
+    {
+        case DIST_BALL:
+            // Same sizes the original rand() based setup used
+            ic.radius = 1.0f;
+            ic.speed = 0.1f;
+            break;
+        case DIST_SHELL:
+            ic.radius = 500.0f;
+            ic.speed = 0.1f;
+            break;
+        case DIST_PLUMMER:
+            ic.radius = 100.0f;
+            ic.speed = 0.5f;
+            break;
+        default:
+            ic.radius = 150.0f;
+            ic.speed = 0.02f;
+            break;
+    }
+    return ic;
+}
+
+// One exponential disk in the XZ plane around the origin.
+// Surface density e^(-r/h) means r ~ r e^(-r/h), a Gamma(2, h): the sum of two exponentials
+inline void exponentialDisk(ParticleRandom &random, float scaleLength, float centralAccel, float speed,
+                            glm::vec3 &position, glm::vec3 &velocity)
+{
+    float r = -scaleLength * logf(random.uniform() * random.uniform());
+    // Keep clear of the singular center
+    r = std::max(r, 0.05f * scaleLength);
+    float phi = 6.2831853f * random.uniform();
+    float height = 0.05f * scaleLength * random.normal();
+    glm::vec3 radial(cosf(phi), 0.0f, sinf(phi));
+    position = radial * r + glm::vec3(0.0f, height, 0.0f);
+    // Circular orbit around a central mass, counterclockwise seen from +y
+    float circular = sqrtf(centralAccel / r);
+    glm::vec3 tangent(-radial.z, 0.0f, radial.x);
+    // One statement per draw: the order arguments are evaluated in is up to the compiler,
+    //  and seed.glsl has to draw them in the same order
+    glm::vec3 jitter;
+    jitter.x = random.normal();
+    jitter.y = random.normal();
+    jitter.z = random.normal();
+    velocity = tangent * circular + speed * jitter;
+}
+
+// Position and velocity of particle index. Only depends on the settings and the index
+inline void generateParticle(const InitialConditions &ic, uint64_t index, glm::vec3 &position, glm::vec3 &velocity)
+{
+    ParticleRandom random(ic.seed, index);
+    switch(ic.distribution)
+    {
+        case DIST_BALL:
+        {
+            // Cube root, so every volume element is equally likely.
+            // Draws are kept in separate statements here too, see exponentialDisk()
+            glm::vec3 direction = random.direction();
+            position = direction * (ic.radius * cbrtf(random.uniform()));
+            direction = random.direction();
+            velocity = direction * (ic.speed * cbrtf(random.uniform()));
+            break;
+        }
+        case DIST_SHELL:
+        {
+            glm::vec3 direction = random.direction();
+            position = direction * (ic.radius * random.between(0.98f, 1.0f));
+            direction = random.direction();
+            velocity = direction * (ic.speed * cbrtf(random.uniform()));
+            break;
+        }
+        case DIST_PLUMMER:
+        {
+            // Aarseth, Henon & Wielen 1974: invert the cumulative mass for the radius, then
+            //  rejection-sample q = v / v_escape from g(q) = q^2 (1 - q^2)^3.5
+            float mass = std::min(random.uniform(), 0.999f);
+            float r = 1.0f / sqrtf(powf(mass, -2.0f / 3.0f) - 1.0f);
+            float q = 0.0f;
+            for(int attempt = 0; attempt < 64; attempt++)
+            {
+                q = random.uniform();
+                float g = q * q * powf(1.0f - q * q, 3.5f);
+                // g peaks just under 0.1
+                if(0.1f * random.uniform() < g)
+                {
+                    break;
+                }
+            }
+            float escape = sqrtf(2.0f) * powf(1.0f + r * r, -0.25f);
+            glm::vec3 direction = random.direction();
+            position = direction * (r * ic.radius);
+            direction = random.direction();
+            velocity = direction * (q * escape * ic.speed);
+            break;
+        }
+        case DIST_DISK:
+        {
+            exponentialDisk(random, ic.radius, ic.centralAccel, ic.speed, position, velocity);
+            break;
+        }
+        default:
+        {
+            // Even particles in one galaxy, odd in the other. Each gets half the mass,
+            //  the second is tilted and they're offset sideways so it's a glancing hit
+            int galaxy = (int)(index & 1);
+            exponentialDisk(random, 0.6f * ic.radius, 0.5f * ic.centralAccel, ic.speed, position, velocity);
+            if(galaxy == 1)
+            {
+                float tilt = 1.0471976f; // 60 degrees around x
+                float c = cosf(tilt), s = sinf(tilt);
+                position = glm::vec3(position.x, c * position.y - s * position.z, s * position.y + c * position.z);
+                velocity = glm::vec3(velocity.x, c * velocity.y - s * velocity.z, s * velocity.y + c * velocity.z);
+            }
+            float side = galaxy == 0 ? -1.0f : 1.0f;
+            position += glm::vec3(side * 0.5f * ic.separation, 0.0f, side * 0.125f * ic.separation);
+            velocity += glm::vec3(-side * 0.5f * ic.approachSpeed, 0.0f, 0.0f);
+            break;
+        }
+    }
+}
+
+// Particles generated ahead of time into plain arrays, from a background thread (which
+//  hands the work to the CPU backend's worker pool), for when they're wanted before there's
+//  anywhere to put them: while the window and GL context are still coming up, say.
+// take() waits for them and says whether they're the particles asked for
+class ParticlePregenerator {
+    public:
+        // The pool has to outlive the pregenerator
+        ParticlePregenerator(CPUParticleSim &pool)
+        : pool(pool), count(0)
+        {}
+        ~ParticlePregenerator()
+        {
+            wait();
+        }
+        void start(const InitialConditions &ic, size_t particles)
+        {
+            wait();
+            conditions = ic;
+            count = particles;
+            worker = std::thread([this]() {
+                positions.resize(count);
+                velocities.resize(count);
+                // generateParticle() is order independent, so the split never changes the result
+                pool.parallelRange(count, [this](size_t begin, size_t end) {
+                    for(size_t i = begin; i < end; i++)
+                    {
+                        generateParticle(conditions, i, positions[i], velocities[i]);
+                    }
+                });
+            });
+        }
+        // True, once they're done, if they're exactly these particles
+        bool take(const InitialConditions &ic, size_t particles)
+        {
+            wait();
+            return count != 0 && count == particles && memcmp(&conditions, &ic, sizeof(ic)) == 0;
+        }
+        const glm::vec3 *getPositions()
+        {
+            return &positions[0];
+        }
+        const glm::vec3 *getVelocities()
+        {
+            return &velocities[0];
+        }
+        // They're only good once, after that the memory is better off freed
+        void release()
+        {
+            wait();
+            count = 0;
+            std::vector<glm::vec3>().swap(positions);
+            std::vector<glm::vec3>().swap(velocities);
+        }
+    private:
+        CPUParticleSim &pool;
+        std::thread worker;
+        InitialConditions conditions;
+        size_t count;
+        std::vector<glm::vec3> positions, velocities;
+
+        void wait()
+        {
+            if(worker.joinable())
+            {
+                worker.join();
+            }
+        }
+
+        // Owns a thread writing into it
+        ParticlePregenerator(const ParticlePregenerator &);
+        ParticlePregenerator &operator=(const ParticlePregenerator &);
+};
+
+#endif
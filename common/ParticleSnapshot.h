@@ -0,0 +1,104 @@
+#ifndef PARTICLESNAPSHOT_H
+#define PARTICLESNAPSHOT_H
+
+// General includes
+#include <string.h>
+#include <vector>
+
+// Opengl includes
+#include <GL/glew.h>
+
+// Project-specific includes
+#include "BufferPool.h"
+
+// GPU-side copy of the initial particles, so restarting is a buffer-to-buffer copy
+//  instead of seeding everything again.
+// The snapshot remembers a key describing what it holds (whatever the caller packs
+//  into it: seed, count, layout...). restore() only copies when the key matches.
+// All of the buffers (any number of shards of them) are stored back to back in one
+//  buffer from the pool.
+class ParticleSnapshot {
+    public:
+        ParticleSnapshot(BufferPool &bufferPool)
+        : pool(bufferPool), slot(bufferPool.addSlot(0)), size(0)
+        {}
+        // Copy the first bytes[i] of every buffers[i] into the snapshot, which now holds key.
+        // Returns false, and holds nothing, if there isn't the memory for it
+        bool save(const std::vector<GLuint> &buffers, const std::vector<GLsizeiptr> &bytes, const void *key, size_t keySize)
+        {
+            size = totalBytes(bytes);
+            GLuint buffer = pool.reserve(slot, size);
+            if(pool.getCapacity(slot) < size)
+            {
+                release();
+                return false;
+            }
+            // The buffers were probably just written by a compute shader
+            glMemoryBarrier(GL_BUFFER_UPDATE_BARRIER_BIT);
+            glBindBuffer(GL_COPY_WRITE_BUFFER, buffer);
+            GLintptr offset = 0;
+            for(size_t i = 0; i < buffers.size(); i++)
+            {
+                glBindBuffer(GL_COPY_READ_BUFFER, buffers[i]);
+                glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, offset, bytes[i]);
+                offset += bytes[i];
+            }
+            savedKey.assign((const char *)key, (const char *)key + keySize);
+            return true;
+        }
+        // Copy the snapshot back into the buffers, if it holds key.
+        // Returns false (and copies nothing) if it doesn't
+        bool restore(const std::vector<GLuint> &buffers, const std::vector<GLsizeiptr> &bytes, const void *key, size_t keySize)
+        {
+            if(!holds(key, keySize) || size != totalBytes(bytes))
+            {
+                return false;
+            }
+            // Shaders may still be reading the old contents, copies are ordered after them
+            glBindBuffer(GL_COPY_READ_BUFFER, pool.getBuffer(slot));
+            GLintptr offset = 0;
+            for(size_t i = 0; i < buffers.size(); i++)
+            {
+                glBindBuffer(GL_COPY_WRITE_BUFFER, buffers[i]);
+                glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, offset, 0, bytes[i]);
+                offset += bytes[i];
+            }
+            return true;
+        }
+        bool holds(const void *key, size_t keySize)
+        {
+            return pool.getBuffer(slot) != 0 && savedKey.size() == keySize && memcmp(&savedKey[0], key, keySize) == 0;
+        }
+        void release()
+        {
+            pool.release(slot);
+            size = 0;
+            savedKey.clear();
+        }
+        // Bytes of GPU memory the snapshot takes, can be more than it holds
+        GLsizeiptr getSize()
+        {
+            return pool.getCapacity(slot);
+        }
+    private:
+        BufferPool &pool;
+        int slot;
+        GLsizeiptr size;            // bytes in use
+        std::vector<char> savedKey;
+
+        static GLsizeiptr totalBytes(const std::vector<GLsizeiptr> &bytes)
+        {
+            GLsizeiptr total = 0;
+            for(size_t i = 0; i < bytes.size(); i++)
+            {
+                total += bytes[i];
+            }
+            return total;
+        }
+
+        // Owns a pool slot
+        ParticleSnapshot(const ParticleSnapshot &);
+        ParticleSnapshot &operator=(const ParticleSnapshot &);
+};
+
+#endif
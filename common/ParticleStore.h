@@ -0,0 +1,290 @@
+#ifndef PARTICLESTORE_H
+#define PARTICLESTORE_H
+
+// General includes
+#include <stdlib.h>
+#include <string.h>
+#include <stddef.h>
+#include <sys/mman.h>
+#include <vector>
+#include <algorithm>
+
+// Opengl includes
+#include <glm/glm.hpp>
+
+// Project-specific includes
+#include "CompactParticles.h"
+
+// Structure-of-arrays particle storage for the CPU backend.
+// The SSBOs hold one vec4 per particle per attribute, where w is always 1 or 0.
+// Here every component gets its own column instead, so a SIMD register can be filled
+//  with one load and no lane is spent on w.
+// Columns are padded to a multiple of PARTICLE_STORE_PAD particles, so kernels can
+//  always run whole AVX-512 registers and never need a tail.
+// Memory comes straight from mmap and is never written here: nothing is physically
+//  allocated until touch() runs, which lets the threads that will update a range
+//  be the ones that first touch it (Linux then puts those pages on their NUMA node).
+// Every column starts on a page boundary, so no page is shared between two columns.
+#define PARTICLE_STORE_PAD 16
+#define SMALL_PAGE_SIZE 4096
+#define HUGE_PAGE_SIZE (2 * 1024 * 1024)
+
+// How the columns should be backed
+//  HUGEPAGES_OFF: plain 4K pages
+//  HUGEPAGES_TRANSPARENT: madvise() so the kernel can use transparent huge pages
+//  HUGEPAGES_EXPLICIT: MAP_HUGETLB, needs pages reserved in /proc/sys/vm/nr_hugepages.
+//      Falls back to transparent if there aren't enough
+enum HugePageMode { HUGEPAGES_OFF, HUGEPAGES_TRANSPARENT, HUGEPAGES_EXPLICIT };
+
+// Where particles [first, first + count) are in GPU layout, e.g. one mapped SSBO shard.
+// Particle first + i is entry i of each array: a vec4, or COMPACT_UINTS_PER_PARTICLE uints
+//  in the compact layout. colors is NULL when there's no Col buffer
+struct ParticleSpan {
+    size_t first, count;
+    void *positions, *velocities;
+    glm::vec4 *colors;
+};
+
+// Call fn(span, begin, end) for every piece of [begin, end) that falls in one of spans
+template<typename Fn>
+inline void forEachSpan(const std::vector<ParticleSpan> &spans, size_t begin, size_t end, Fn fn)
+{
+    for(size_t s = 0; s < spans.size(); s++)
+    {
+        size_t spanBegin = std::max(begin, spans[s].first);
+        size_t spanEnd = std::min(end, spans[s].first + spans[s].count);
+        if(spanBegin < spanEnd)
+        {
+            fn(spans[s], spanBegin, spanEnd);
+        }
+    }
+}
+
+class ParticleStore {
+    public:
+        enum Column { PX, PY, PZ, VX, VY, VZ, CR, CG, CB, NUM_COLUMNS };
+
+        ParticleStore()
+        : data(NULL), count(0), paddedCount(0), columnStride(0), mappedBytes(0),
+          requestedPages(HUGEPAGES_OFF), activePages(HUGEPAGES_OFF)
+        {}
+        ~ParticleStore()
+        {
+            release();
+        }
+        void setHugePages(HugePageMode mode)
+        {
+            // Takes effect on the next resize()
+            requestedPages = mode;
+        }
+        HugePageMode getHugePages()
+        {
+            // What the current allocation actually got
+            return activePages;
+        }
+        void resize(size_t newCount)
+        {
+            // Contents are not kept, the only callers refill everything anyway.
+            // Call touch() over the whole padded range before using the store
+            size_t newPadded = (newCount + PARTICLE_STORE_PAD - 1) / PARTICLE_STORE_PAD * PARTICLE_STORE_PAD;
+            size_t pageFloats = (requestedPages == HUGEPAGES_OFF ? SMALL_PAGE_SIZE : HUGE_PAGE_SIZE) / sizeof(float);
+            size_t newStride = (newPadded + pageFloats - 1) / pageFloats * pageFloats;
+
+            release();
+            count = newCount;
+            paddedCount = newPadded;
+            columnStride = newStride;
+            if(newStride > 0 && !allocate(NUM_COLUMNS * newStride * sizeof(float)))
+            {
+                count = paddedCount = columnStride = 0;
+            }
+        }
+        // Zero [begin, end) of every column.
+        // This is the first write to those pages, so call it from the thread that owns the range
+        void touch(size_t begin, size_t end)
+        {
+            for(int c = 0; c < NUM_COLUMNS; c++)
+            {
+                memset(column(c) + begin, 0, (end - begin) * sizeof(float));
+            }
+        }
+        size_t size()
+        {
+            return count;
+        }
+        size_t paddedSize()
+        {
+            return paddedCount;
+        }
+        // Particles per page, ranges that start on a multiple of this never share pages
+        size_t pageParticles()
+        {
+            return (activePages == HUGEPAGES_OFF ? SMALL_PAGE_SIZE : HUGE_PAGE_SIZE) / sizeof(float);
+        }
+        float *column(int c)
+        {
+            return data + c * columnStride;
+        }
+        // Unpack [begin, end) from the vec4 layout the SSBOs use, the range has to be in span.
+        // span.colors can be NULL when there's no Col buffer (colors from velocity mode),
+        //  the color columns are then left as they are
+        void fromVec4(const ParticleSpan &span, size_t begin, size_t end)
+        {
+            const glm::vec4 *positions = (const glm::vec4 *)span.positions;
+            const glm::vec4 *velocities = (const glm::vec4 *)span.velocities;
+            float *px = column(PX), *py = column(PY), *pz = column(PZ);
+            float *vx = column(VX), *vy = column(VY), *vz = column(VZ);
+            for(size_t i = begin; i < end; i++)
+            {
+                const glm::vec4 &p = positions[i - span.first], &v = velocities[i - span.first];
+                px[i] = p.x; py[i] = p.y; pz[i] = p.z;
+                vx[i] = v.x; vy[i] = v.y; vz[i] = v.z;
+            }
+            fromVec4Colors(span, begin, end);
+        }
+        // Pack [begin, end) back into the SSBO layout.
+        // w is constant on the GPU side: 1 for positions and colors, 0 for velocities.
+        // span.colors can be NULL, same as fromVec4()
+        void toVec4(const ParticleSpan &span, size_t begin, size_t end)
+        {
+            glm::vec4 *positions = (glm::vec4 *)span.positions;
+            glm::vec4 *velocities = (glm::vec4 *)span.velocities;
+            const float *px = column(PX), *py = column(PY), *pz = column(PZ);
+            const float *vx = column(VX), *vy = column(VY), *vz = column(VZ);
+            for(size_t i = begin; i < end; i++)
+            {
+                positions[i - span.first] = glm::vec4(px[i], py[i], pz[i], 1.0f);
+                velocities[i - span.first] = glm::vec4(vx[i], vy[i], vz[i], 0.0f);
+            }
+            toVec4Colors(span, begin, end);
+        }
+        // Same as fromVec4(), for the compact layout (see CompactParticles.h).
+        // Colors aren't compacted, they're still vec4s or NULL
+        void fromCompact(const ParticleSpan &span, const glm::vec4 &box, size_t begin, size_t end)
+        {
+            const unsigned int *positions = (const unsigned int *)span.positions;
+            const unsigned int *velocities = (const unsigned int *)span.velocities;
+            float *px = column(PX), *py = column(PY), *pz = column(PZ);
+            float *vx = column(VX), *vy = column(VY), *vz = column(VZ);
+            for(size_t i = begin; i < end; i++)
+            {
+                size_t q = (i - span.first) * COMPACT_UINTS_PER_PARTICLE;
+                glm::vec3 p = decodePosition(&positions[q], box);
+                glm::vec3 v = decodeVelocity(&velocities[q]);
+                px[i] = p.x; py[i] = p.y; pz[i] = p.z;
+                vx[i] = v.x; vy[i] = v.y; vz[i] = v.z;
+            }
+            fromVec4Colors(span, begin, end);
+        }
+        // The store keeps full floats, so the CPU backend only loses precision on the way out
+        void toCompact(const ParticleSpan &span, const glm::vec4 &box, size_t begin, size_t end)
+        {
+            unsigned int *positions = (unsigned int *)span.positions;
+            unsigned int *velocities = (unsigned int *)span.velocities;
+            const float *px = column(PX), *py = column(PY), *pz = column(PZ);
+            const float *vx = column(VX), *vy = column(VY), *vz = column(VZ);
+            for(size_t i = begin; i < end; i++)
+            {
+                size_t q = (i - span.first) * COMPACT_UINTS_PER_PARTICLE;
+                encodePosition(glm::vec3(px[i], py[i], pz[i]), box, &positions[q]);
+                encodeVelocity(glm::vec3(vx[i], vy[i], vz[i]), &velocities[q]);
+            }
+            toVec4Colors(span, begin, end);
+        }
+    private:
+        float *data;
+        size_t count, paddedCount, columnStride, mappedBytes;
+        HugePageMode requestedPages, activePages;
+
+        // Colors are vec4s in every layout, NULL when there's no Col buffer
+        void fromVec4Colors(const ParticleSpan &span, size_t begin, size_t end)
+        {
+            const glm::vec4 *colors = span.colors;
+            float *cr = column(CR), *cg = column(CG), *cb = column(CB);
+            for(size_t i = begin; i < end && colors != NULL; i++)
+            {
+                const glm::vec4 &c = colors[i - span.first];
+                cr[i] = c.r; cg[i] = c.g; cb[i] = c.b;
+            }
+        }
+        void toVec4Colors(const ParticleSpan &span, size_t begin, size_t end)
+        {
+            glm::vec4 *colors = span.colors;
+            const float *cr = column(CR), *cg = column(CG), *cb = column(CB);
+            for(size_t i = begin; i < end && colors != NULL; i++)
+            {
+                colors[i - span.first] = glm::vec4(cr[i], cg[i], cb[i], 1.0f);
+            }
+        }
+        bool allocate(size_t bytes)
+        {
+            void *mem = MAP_FAILED;
+            activePages = requestedPages;
+#ifdef MAP_HUGETLB
+            if(requestedPages == HUGEPAGES_EXPLICIT)
+            {
+                mem = mmap(NULL, bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+                if(mem == MAP_FAILED)
+                {
+                    // Usually just means nobody reserved enough huge pages
+                    activePages = HUGEPAGES_TRANSPARENT;
+                }
+            }
+#else
+            if(requestedPages == HUGEPAGES_EXPLICIT)
+            {
+                activePages = HUGEPAGES_TRANSPARENT;
+            }
+#endif
+            if(mem == MAP_FAILED)
+            {
+                // Thread chunks are split at huge page multiples from data, which only
+                //  keeps them on pages of their own if data is on a huge page boundary.
+                //  mmap doesn't promise that, so map a huge page extra and trim it off
+                size_t slack = activePages == HUGEPAGES_TRANSPARENT ? HUGE_PAGE_SIZE : 0;
+                mem = mmap(NULL, bytes + slack, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+                if(mem == MAP_FAILED)
+                {
+                    return false;
+                }
+                if(slack != 0)
+                {
+                    char *raw = (char *)mem;
+                    size_t head = (HUGE_PAGE_SIZE - (size_t)raw % HUGE_PAGE_SIZE) % HUGE_PAGE_SIZE;
+                    if(head != 0)
+                    {
+                        munmap(raw, head);
+                    }
+                    if(slack - head != 0)
+                    {
+                        munmap(raw + head + bytes, slack - head);
+                    }
+                    mem = raw + head;
+                }
+#ifdef MADV_HUGEPAGE
+                if(activePages == HUGEPAGES_TRANSPARENT)
+                {
+                    madvise(mem, bytes, MADV_HUGEPAGE);
+                }
+#endif
+            }
+            data = (float *)mem;
+            mappedBytes = bytes;
+            return true;
+        }
+        void release()
+        {
+            if(data != NULL)
+            {
+                munmap(data, mappedBytes);
+            }
+            data = NULL;
+            mappedBytes = 0;
+        }
+
+        // One big allocation, copying it around by accident would be expensive
+        ParticleStore(const ParticleStore &);
+        ParticleStore &operator=(const ParticleStore &);
+};
+
+#endif
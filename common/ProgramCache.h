@@ -0,0 +1,167 @@
+#ifndef PROGRAMCACHE_H
+#define PROGRAMCACHE_H
+
+// General includes
+#include <stdio.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <fstream>
+#include <sys/stat.h>
+
+// Opengl includes
+#include <GL/glew.h>
+
+// Bumped whenever the file layout changes, old files are then just misses
+#define PROGRAM_CACHE_VERSION 1
+
+// Linked programs kept on disk (glGetProgramBinary / glProgramBinary), so a launch only
+//  compiles the GLSL it has never seen on this driver.
+// Programs are looked up by a key the caller builds from everything that went into them:
+//  the full source of every stage after the #defines were put in. The device (GL_VENDOR,
+//  GL_RENDERER, GL_VERSION, which carries the driver version) is added here.
+// Each program is one file named after a hash of all that. The file also holds the whole
+//  key, so a hash collision is a miss and not the wrong program.
+// Drivers may still reject a binary they wrote (after an update, say), load() then returns
+//  0 and the caller compiles from source like there was no cache at all.
+class ProgramCache {
+    public:
+        ProgramCache()
+        : cacheDir("shader_cache"), enabled(true), hits(0), misses(0)
+        {}
+        void setEnabled(bool enable)
+        {
+            enabled = enable;
+        }
+        // Program for key from the cache, or 0 if there isn't a usable one
+        GLuint load(const std::string &key)
+        {
+            if(!available())
+            {
+                misses++;
+                return 0;
+            }
+            std::string fullKey = key + deviceKey();
+            std::ifstream file(pathFor(fullKey).c_str(), std::ios::in | std::ios::binary);
+            uint32_t header[4] = {0, 0, 0, 0};   // magic, version, binary format, key length
+            uint64_t binaryLength = 0;
+            if(!file.read((char *)header, sizeof(header)) || !file.read((char *)&binaryLength, sizeof(binaryLength)) ||
+               header[0] != magic() || header[1] != PROGRAM_CACHE_VERSION || header[3] != fullKey.size())
+            {
+                misses++;
+                return 0;
+            }
+            std::string savedKey(fullKey.size(), '\0');
+            std::vector<char> binary(binaryLength);
+            if(!file.read(&savedKey[0], savedKey.size()) || savedKey != fullKey ||
+               binaryLength == 0 || !file.read(&binary[0], binary.size()))
+            {
+                misses++;
+                return 0;
+            }
+
+            GLuint program = glCreateProgram();
+            glProgramBinary(program, header[2], &binary[0], (GLsizei)binary.size());
+            GLint linked = GL_FALSE;
+            glGetProgramiv(program, GL_LINK_STATUS, &linked);
+            if(linked != GL_TRUE)
+            {
+                glDeleteProgram(program);
+                misses++;
+                return 0;
+            }
+            hits++;
+            return program;
+        }
+        // Call on a program before linking it, so the driver keeps its binary around
+        void prepare(GLuint program)
+        {
+            if(available())
+            {
+                glProgramParameteri(program, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+            }
+        }
+        // Store a freshly linked program under key. Programs that failed to link aren't kept
+        void save(const std::string &key, GLuint program)
+        {
+            GLint linked = GL_FALSE, length = 0;
+            glGetProgramiv(program, GL_LINK_STATUS, &linked);
+            if(!available() || linked != GL_TRUE)
+            {
+                return;
+            }
+            glGetProgramiv(program, GL_PROGRAM_BINARY_LENGTH, &length);
+            if(length <= 0)
+            {
+                return;
+            }
+            std::vector<char> binary(length);
+            GLenum format = 0;
+            glGetProgramBinary(program, length, &length, &format, &binary[0]);
+
+            std::string fullKey = key + deviceKey();
+            mkdir(cacheDir.c_str(), 0755);
+            std::ofstream file(pathFor(fullKey).c_str(), std::ios::out | std::ios::binary | std::ios::trunc);
+            if(!file.is_open())
+            {
+                printf("Couldn't write to %s/, shaders will be compiled again next time\n", cacheDir.c_str());
+                return;
+            }
+            uint32_t header[4] = {magic(), PROGRAM_CACHE_VERSION, format, (uint32_t)fullKey.size()};
+            uint64_t binaryLength = (uint64_t)length;
+            file.write((const char *)header, sizeof(header));
+            file.write((const char *)&binaryLength, sizeof(binaryLength));
+            file.write(fullKey.data(), fullKey.size());
+            file.write(&binary[0], length);
+        }
+        // Programs loaded from disk, and programs that had to be compiled, since startup
+        int getHits()
+        {
+            return hits;
+        }
+        int getMisses()
+        {
+            return misses;
+        }
+    private:
+        std::string cacheDir;
+        bool enabled;
+        int hits, misses;
+
+        // Drivers are allowed to support no binary formats at all
+        bool available()
+        {
+            GLint formats = 0;
+            glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &formats);
+            return enabled && formats > 0;
+        }
+        std::string deviceKey()
+        {
+            std::string key = "\n";
+            key += (const char *)glGetString(GL_VENDOR);
+            key += " | ";
+            key += (const char *)glGetString(GL_RENDERER);
+            key += " | ";
+            key += (const char *)glGetString(GL_VERSION);
+            return key;
+        }
+        // FNV-1a, 64 bit. Only names the file, the key inside decides
+        std::string pathFor(const std::string &fullKey)
+        {
+            uint64_t hash = 14695981039346656037ull;
+            for(size_t i = 0; i < fullKey.size(); i++)
+            {
+                hash ^= (unsigned char)fullKey[i];
+                hash *= 1099511628211ull;
+            }
+            char name[32];
+            snprintf(name, sizeof(name), "%016llx.bin", (unsigned long long)hash);
+            return cacheDir + "/" + name;
+        }
+        static uint32_t magic()
+        {
+            return 0x4E494250;  // "PBIN"
+        }
+};
+
+#endif
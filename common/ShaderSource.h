@@ -0,0 +1,174 @@
+#ifndef SHADERSOURCE_H
+#define SHADERSOURCE_H
+
+// General includes
+#include <stdio.h>
+#include <string>
+#include <sstream>
+#include <fstream>
+#include <vector>
+#include <map>
+#include <algorithm>
+
+// One of the shaders/ files, as compiled into the program (see the makefile)
+struct EmbeddedShader {
+    const char *name;
+    const char *source;
+};
+
+// The #defines one variant of a shader is built with.
+// Kept sorted by name, so the same set always gives the same text, and that text is what
+//  variants are told apart by
+class ShaderDefines {
+    public:
+        // #define name value, or just #define name
+        ShaderDefines &set(const std::string &name, const std::string &value = "")
+        {
+            values[name] = value;
+            return *this;
+        }
+        ShaderDefines &set(const std::string &name, int value)
+        {
+            std::ostringstream text;
+            text << value;
+            return set(name, text.str());
+        }
+        bool has(const std::string &name) const
+        {
+            return values.count(name) != 0;
+        }
+        // One #define line each
+        std::string str() const
+        {
+            std::string text;
+            for(std::map<std::string, std::string>::const_iterator it = values.begin(); it != values.end(); ++it)
+            {
+                text += "#define " + it->first + (it->second.empty() ? "" : " " + it->second) + "\n";
+            }
+            return text;
+        }
+    private:
+        std::map<std::string, std::string> values;
+};
+
+// Where shader files come from, and the preprocessing GLSL doesn't do itself.
+// Files are looked up by name ("compute.glsl") in the sources compiled into the program,
+//  so it runs from any directory. With setDirectory() they're read from disk instead, to
+//  try out shader edits without rebuilding.
+// preprocess() puts the defines after the #version line and expands
+//      #include "name.glsl"
+//  lines, each file only the first time, so shared blocks can be included from anywhere.
+// #line directives keep compiler messages pointing at the right file and line: the first
+//  number in "0:12(3): error" is the file's index in the list preprocess() fills in
+class ShaderLibrary {
+    public:
+        ShaderLibrary(const EmbeddedShader *shaders, size_t count)
+        : embedded(shaders, shaders + count)
+        {}
+        void setDirectory(const std::string &path)
+        {
+            directory = path;
+        }
+        // Whole file, as it is. False (with a message) if there's no such file
+        bool read(const std::string &name, std::string &code)
+        {
+            if(!directory.empty())
+            {
+                std::string path = directory + "/" + name;
+                std::ifstream stream(path.c_str(), std::ios::in);
+                if(!stream.is_open())
+                {
+                    printf("Impossible to open %s. Are you in the right directory ?\n", path.c_str());
+                    return false;
+                }
+                std::stringstream sstr;
+                sstr << stream.rdbuf();
+                code = sstr.str();
+                return true;
+            }
+            for(size_t i = 0; i < embedded.size(); i++)
+            {
+                if(name == embedded[i].name)
+                {
+                    code = embedded[i].source;
+                    return true;
+                }
+            }
+            printf("No shader called %s was built in, is it in shaders/?\n", name.c_str());
+            return false;
+        }
+        // name with the defines put in and its #includes expanded.
+        // files gets every file that went in, in source string number order
+        bool preprocess(const std::string &name, const ShaderDefines &defines, std::string &code, std::vector<std::string> &files)
+        {
+            code.clear();
+            files.clear();
+            return expand(name, &defines, code, files);
+        }
+    private:
+        std::vector<EmbeddedShader> embedded;
+        std::string directory;          // empty for the built in sources
+
+        // Appends name to code, defines only for the top file
+        bool expand(const std::string &name, const ShaderDefines *defines, std::string &code, std::vector<std::string> &files)
+        {
+            std::string source;
+            if(!read(name, source))
+            {
+                return false;
+            }
+            int fileIndex = (int)files.size();
+            files.push_back(name);
+            if(fileIndex > 0)
+            {
+                std::ostringstream directive;
+                directive << "#line 1 " << fileIndex << "\n";
+                code += directive.str();
+            }
+            std::istringstream lines(source);
+            std::string line;
+            int lineNumber = 0;
+            while(std::getline(lines, line))
+            {
+                lineNumber++;
+                size_t start = line.find_first_not_of(" \t");
+                if(start != std::string::npos && line.compare(start, 8, "#include") == 0)
+                {
+                    size_t open = line.find('"', start);
+                    size_t close = open == std::string::npos ? open : line.find('"', open + 1);
+                    if(close == std::string::npos)
+                    {
+                        printf("%s:%d: #include needs a \"file name\"\n", name.c_str(), lineNumber);
+                        return false;
+                    }
+                    std::string included = line.substr(open + 1, close - open - 1);
+                    if(std::find(files.begin(), files.end(), included) == files.end())
+                    {
+                        if(!expand(included, NULL, code, files))
+                        {
+                            return false;
+                        }
+                    }
+                    // Back to this file, on the line after the #include
+                    std::ostringstream directive;
+                    directive << "#line " << lineNumber + 1 << " " << fileIndex << "\n";
+                    code += directive.str();
+                    continue;
+                }
+                if(lineNumber == 1 && defines != NULL)
+                {
+                    // #defines have to go after the #version line, which has to come first
+                    if(line.compare(0, 8, "#version") == 0)
+                    {
+                        code += line + "\n" + defines->str() + "#line 2 0\n";
+                        continue;
+                    }
+                    code += defines->str() + "#line 1 0\n";
+                }
+                code += line + "\n";
+            }
+            return true;
+        }
+};
+
+#endif
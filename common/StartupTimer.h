@@ -0,0 +1,50 @@
+#ifndef STARTUPTIMER_H
+#define STARTUPTIMER_H
+
+// General includes
+#include <stdio.h>
+#include <string>
+#include <vector>
+#include <chrono>
+
+// Wall clock time of each startup phase, for working out where time to first frame goes.
+// The clock starts when the timer is constructed, as a global that's before main().
+// Phases are whatever happened between two mark() calls, named by the later one
+class StartupTimer {
+    public:
+        StartupTimer()
+        : launch(std::chrono::steady_clock::now()), last(launch)
+        {}
+        void mark(const char *phase)
+        {
+            std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+            phases.push_back(Phase());
+            phases.back().name = phase;
+            phases.back().ms = std::chrono::duration<double, std::milli>(now - last).count();
+            phases.back().sinceLaunch = std::chrono::duration<double, std::milli>(now - launch).count();
+            last = now;
+        }
+        // One line per phase, with how long into startup it ended
+        void print()
+        {
+            printf("Startup:\n");
+            for(size_t i = 0; i < phases.size(); i++)
+            {
+                printf("  %-22s %8.1f ms  (at %.1f ms)\n", phases[i].name.c_str(), phases[i].ms, phases[i].sinceLaunch);
+            }
+        }
+        struct Phase {
+            std::string name;
+            double ms;              // since the previous mark
+            double sinceLaunch;     // when it ended
+        };
+        const std::vector<Phase> &getPhases()
+        {
+            return phases;
+        }
+    private:
+        std::chrono::steady_clock::time_point launch, last;
+        std::vector<Phase> phases;
+};
+
+#endif
@@ -0,0 +1,151 @@
+#ifndef UNIFORMRING_H
+#define UNIFORMRING_H
+
+// General includes
+#include <stdio.h>
+#include <string.h>
+#include <vector>
+
+// Opengl includes
+#include <GL/glew.h>
+
+// Versions of each block kept in the ring. A new version only overwrites the oldest one
+//  once the GPU is done with it, so this many steps can be queued before anything waits
+#define UNIFORM_RING_SLOTS 64
+
+// Uniform blocks (std140) fed from one uniform buffer.
+// Each block gets a ring of UNIFORM_RING_SLOTS copies in the buffer. update() compares the
+//  new contents with what was uploaded last and does nothing if they match, otherwise it
+//  writes the next copy and points the block's binding at it. Commands already queued keep
+//  reading the copy they were issued with, so several dispatches with different
+//  parameters can be queued back to back without waiting on the GPU.
+// With GL 4.4 / ARB_buffer_storage the buffer is mapped once, persistently, and copies are
+//  plain memcpys guarded by fences. Without it every copy is a glBufferSubData().
+class UniformRing {
+    public:
+        UniformRing()
+        : buffer(0), mapped(NULL), bufferSize(0), uploads(0)
+        {}
+        // Needs a current context. Blocks can only be added before init()
+        int addBlock(GLuint binding, GLsizeiptr size)
+        {
+            Block block;
+            block.binding = binding;
+            block.size = size;
+            block.slotSize = 0;
+            block.offset = 0;
+            block.current = -1;
+            blocks.push_back(block);
+            return (int)blocks.size() - 1;
+        }
+        void init()
+        {
+            // Every copy has to start on the driver's binding alignment
+            GLint alignment = 256;
+            glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &alignment);
+            bufferSize = 0;
+            for(size_t i = 0; i < blocks.size(); i++)
+            {
+                blocks[i].slotSize = (blocks[i].size + alignment - 1) / alignment * alignment;
+                blocks[i].offset = bufferSize;
+                blocks[i].current = -1;
+                blocks[i].lastData.clear();
+                blocks[i].fences.assign(UNIFORM_RING_SLOTS, (GLsync)0);
+                bufferSize += blocks[i].slotSize * UNIFORM_RING_SLOTS;
+            }
+
+            glGenBuffers(1, &buffer);
+            glBindBuffer(GL_UNIFORM_BUFFER, buffer);
+            if(GLEW_ARB_buffer_storage)
+            {
+                // Coherent, so a memcpy is visible to every command issued after it
+                GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+                glBufferStorage(GL_UNIFORM_BUFFER, bufferSize, NULL, flags);
+                mapped = (char *)glMapBufferRange(GL_UNIFORM_BUFFER, 0, bufferSize, flags);
+            }
+            if(mapped == NULL)
+            {
+                glBufferData(GL_UNIFORM_BUFFER, bufferSize, NULL, GL_DYNAMIC_DRAW);
+            }
+        }
+        // Upload data for a block if it changed since last time.
+        // Returns whether anything was uploaded
+        bool update(int blockIndex, const void *data)
+        {
+            Block &block = blocks[blockIndex];
+            if(block.current >= 0 && memcmp(&block.lastData[0], data, block.size) == 0)
+            {
+                return false;
+            }
+            block.lastData.assign((const char *)data, (const char *)data + block.size);
+
+            // Everything that reads the current copy has been issued by now,
+            //  fence it so it's safe to overwrite once the ring comes back around
+            if(mapped != NULL && block.current >= 0)
+            {
+                block.fences[block.current] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+            }
+            int slot = (block.current + 1) % UNIFORM_RING_SLOTS;
+            GLintptr offset = block.offset + slot * block.slotSize;
+            if(mapped != NULL)
+            {
+                waitForSlot(block, slot);
+                memcpy(mapped + offset, data, block.size);
+            }
+            else
+            {
+                glBindBuffer(GL_UNIFORM_BUFFER, buffer);
+                glBufferSubData(GL_UNIFORM_BUFFER, offset, block.size, data);
+            }
+            glBindBufferRange(GL_UNIFORM_BUFFER, block.binding, buffer, offset, block.size);
+            block.current = slot;
+            uploads++;
+            return true;
+        }
+        bool isPersistent()
+        {
+            return mapped != NULL;
+        }
+        // Uploads since init(), to see how often the dirty check actually saves one
+        unsigned long getUploads()
+        {
+            return uploads;
+        }
+    private:
+        struct Block {
+            GLuint binding;
+            GLsizeiptr size, slotSize;
+            GLintptr offset;            // of slot 0 in the buffer
+            int current;                // slot the binding points at, -1 before the first update
+            std::vector<char> lastData;
+            std::vector<GLsync> fences;
+        };
+        std::vector<Block> blocks;
+        GLuint buffer;
+        char *mapped;
+        GLsizeiptr bufferSize;
+        unsigned long uploads;
+
+        void waitForSlot(Block &block, int slot)
+        {
+            GLsync fence = block.fences[slot];
+            if(fence == 0)
+            {
+                return;
+            }
+            // Normally signalled long ago, the ring is much longer than the frames in flight
+            GLenum result = glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000000);
+            if(result == GL_TIMEOUT_EXPIRED || result == GL_WAIT_FAILED)
+            {
+                fprintf(stderr, "Uniform ring waited over a second for the GPU\n");
+            }
+            glDeleteSync(fence);
+            block.fences[slot] = 0;
+        }
+
+        // Owns a persistently mapped buffer
+        UniformRing(const UniformRing &);
+        UniformRing &operator=(const UniformRing &);
+};
+
+#endif
@@ -0,0 +1,243 @@
+#ifndef WORKGROUPTUNER_H
+#define WORKGROUPTUNER_H
+
+// General includes
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <string>
+#include <sstream>
+#include <fstream>
+#include <vector>
+#include <algorithm>
+#include <functional>
+#include <chrono>
+
+// Opengl includes
+#include <GL/glew.h>
+
+// Project-specific includes
+#include "ComputeDispatch.h"
+
+// Local work group sizes worth trying. 100 is what compute.glsl always used to have
+#define WORK_GROUP_CANDIDATES { 32, 64, 100, 128, 192, 256, 384, 512, 768, 1024 }
+
+// Picks the compute shader's local_size_x by trying it.
+// The best size is very different between vendors, and between llvmpipe and real GPUs,
+//  so every candidate the driver allows gets compiled and timed with GL_TIME_ELAPSED
+//  queries. The winner is cached on disk per GL_VENDOR/GL_RENDERER/GL_VERSION,
+//  so tuning only happens the first time the program runs on a new driver or device.
+class WorkGroupTuner {
+    public:
+        WorkGroupTuner()
+        : cachePath("workgroup_cache.txt")
+        {}
+        // Every candidate this driver can actually run
+        std::vector<int> candidates()
+        {
+            GLint maxInvocations = 0, maxSizeX = 0;
+            glGetIntegerv(GL_MAX_COMPUTE_WORK_GROUP_INVOCATIONS, &maxInvocations);
+            glGetIntegeri_v(GL_MAX_COMPUTE_WORK_GROUP_SIZE, 0, &maxSizeX);
+
+            const int all[] = WORK_GROUP_CANDIDATES;
+            std::vector<int> sizes;
+            for(size_t i = 0; i < sizeof(all) / sizeof(all[0]); i++)
+            {
+                if(all[i] <= maxInvocations && all[i] <= maxSizeX)
+                {
+                    sizes.push_back(all[i]);
+                }
+            }
+            return sizes;
+        }
+        // What the cache key looks like for the current context
+        std::string deviceKey()
+        {
+            std::string key;
+            key += (const char *)glGetString(GL_VENDOR);
+            key += " | ";
+            key += (const char *)glGetString(GL_RENDERER);
+            key += " | ";
+            key += (const char *)glGetString(GL_VERSION);
+            return key;
+        }
+        // Cached best size for this device, or 0 if it was never tuned
+        int lookup()
+        {
+            std::string key = deviceKey();
+            std::ifstream cacheFile(cachePath.c_str(), std::ios::in);
+            std::string line;
+            while(std::getline(cacheFile, line))
+            {
+                // Each line is "<size> <device key>"
+                size_t split = line.find(' ');
+                if(split != std::string::npos && line.compare(split + 1, std::string::npos, key) == 0)
+                {
+                    return atoi(line.substr(0, split).c_str());
+                }
+            }
+            return 0;
+        }
+        // Time every candidate and return the fastest.
+        //  build(size) compiles the kernel with that local size and returns the program
+        //  prepare(count) is called after glUseProgram and has to set the uniforms,
+        //   with compute.glsl's particleCount set to count
+        // The kernels run on scratch buffers bound in place of the particle SSBOs,
+        //  so the running simulation isn't touched
+        int tune(const std::function<GLuint(int)> &build, const std::function<void(GLuint)> &prepare, int particleCount)
+        {
+            // Enough work to keep a big GPU busy, without taking forever on llvmpipe
+            GLuint count = (GLuint)std::min(std::max(particleCount, 100000), 4000000);
+            std::vector<int> sizes = candidates();
+
+            // The particle buffers are bound as ranges (pool buffers can be bigger than the
+            //  particles), so the ranges are put back too
+            GLint oldBindings[3];
+            GLint64 oldStarts[3], oldSizes[3];
+            for(int i = 0; i < 3; i++)
+            {
+                glGetIntegeri_v(GL_SHADER_STORAGE_BUFFER_BINDING, 4 + i, &oldBindings[i]);
+                glGetInteger64i_v(GL_SHADER_STORAGE_BUFFER_START, 4 + i, &oldStarts[i]);
+                glGetInteger64i_v(GL_SHADER_STORAGE_BUFFER_SIZE, 4 + i, &oldSizes[i]);
+            }
+            GLuint scratch[3];
+            createScratchBuffers(scratch, count);
+
+            GLuint query;
+            glGenQueries(1, &query);
+
+            times.clear();
+            int best = 0;
+            double bestTime = 0.0;
+            for(size_t i = 0; i < sizes.size(); i++)
+            {
+                GLuint program = build(sizes[i]);
+                if(program == 0)
+                {
+                    continue;
+                }
+                glUseProgram(program);
+                prepare(count);
+
+                // A couple of untimed runs first, the first dispatch of a new
+                //  program often pays for lazy compilation in the driver
+                for(int run = 0; run < 2; run++)
+                {
+                    dispatchParticles(count, sizes[i]);
+                }
+                std::vector<double> runs;
+                for(int run = 0; run < 7; run++)
+                {
+                    // Some drivers (llvmpipe for one) answer every time query with a
+                    //  nanosecond or so. No real dispatch over 100k particles takes under a
+                    //  microsecond, so then the wall clock around a glFinish() is used instead
+                    GLuint64 elapsed = 0;
+                    glFinish();
+                    std::chrono::steady_clock::time_point wallStart = std::chrono::steady_clock::now();
+                    glBeginQuery(GL_TIME_ELAPSED, query);
+                    dispatchParticles(count, sizes[i]);
+                    glEndQuery(GL_TIME_ELAPSED);
+                    glGetQueryObjectui64v(query, GL_QUERY_RESULT, &elapsed);
+                    double wallTime = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - wallStart).count();
+                    runs.push_back(elapsed >= 1000 ? elapsed * 1e-6 : wallTime);
+                }
+                glDeleteProgram(program);
+
+                // Median, one slow run shouldn't decide it
+                std::sort(runs.begin(), runs.end());
+                double median = runs[runs.size() / 2];
+                times.push_back(std::make_pair(sizes[i], median));
+                if(best == 0 || median < bestTime)
+                {
+                    best = sizes[i];
+                    bestTime = median;
+                }
+            }
+
+            glDeleteQueries(1, &query);
+            glDeleteBuffers(3, scratch);
+            for(int i = 0; i < 3; i++)
+            {
+                if(oldSizes[i] > 0)
+                {
+                    glBindBufferRange(GL_SHADER_STORAGE_BUFFER, 4 + i, oldBindings[i], oldStarts[i], oldSizes[i]);
+                }
+                else
+                {
+                    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 4 + i, oldBindings[i]);
+                }
+            }
+            if(best > 0)
+            {
+                save(best);
+            }
+            return best;
+        }
+        // (size, ms) for every candidate of the last tune()
+        const std::vector<std::pair<int, double> > &getTimes()
+        {
+            return times;
+        }
+    private:
+        std::string cachePath;
+        std::vector<std::pair<int, double> > times;
+
+        void createScratchBuffers(GLuint *buffers, GLuint count)
+        {
+            // Particles spread through a sphere of radius ~1000, like a running simulation,
+            //  so the collision branches are taken about as often as they would be
+            std::vector<float> points(count * 4), vels(count * 4, 0.0f);
+            for(GLuint i = 0; i < count; i++)
+            {
+                float t = (float)i / count;
+                float angle = i * 2.39996323f;      // golden angle
+                float radius = 1000.0f * sqrtf(t);
+                points[i*4 + 0] = radius * cosf(angle);
+                points[i*4 + 1] = 2000.0f * t - 1000.0f;
+                points[i*4 + 2] = radius * sinf(angle);
+                points[i*4 + 3] = 1.0f;
+            }
+            glGenBuffers(3, buffers);
+            const float *data[3] = { &points[0], &vels[0], &vels[0] };
+            for(int i = 0; i < 3; i++)
+            {
+                glBindBuffer(GL_SHADER_STORAGE_BUFFER, buffers[i]);
+                glBufferData(GL_SHADER_STORAGE_BUFFER, count * 4 * sizeof(float), data[i], GL_STATIC_DRAW);
+                glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 4 + i, buffers[i]);
+            }
+        }
+        void save(int size)
+        {
+            // Rewrite the cache with this device's entry replaced
+            std::string key = deviceKey();
+            std::vector<std::string> lines;
+            {
+                std::ifstream cacheFile(cachePath.c_str(), std::ios::in);
+                std::string line;
+                while(std::getline(cacheFile, line))
+                {
+                    size_t split = line.find(' ');
+                    if(split == std::string::npos || line.compare(split + 1, std::string::npos, key) != 0)
+                    {
+                        lines.push_back(line);
+                    }
+                }
+            }
+            std::ostringstream entry;
+            entry << size << " " << key;
+            lines.push_back(entry.str());
+
+            std::ofstream cacheFile(cachePath.c_str(), std::ios::out | std::ios::trunc);
+            if(!cacheFile.is_open())
+            {
+                printf("Couldn't write %s, work group size will be tuned again next time\n", cachePath.c_str());
+                return;
+            }
+            for(size_t i = 0; i < lines.size(); i++)
+            {
+                cacheFile << lines[i] << "\n";
+            }
+        }
+};
+
+#endif
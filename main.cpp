@@ -1,11 +1,15 @@
 // General includes
 #include <stdio.h>
+#include <limits.h>
 #include <iostream>
 #include <cstdlib>
 #include <string>
 #include <sstream>
 #include <fstream>
 #include <vector>
+#include <map>
+#include <algorithm>
+#include <chrono>
 
 // Opengl includes
 #include <GL/glew.h>
@@ -27,16 +31,31 @@
 
 // Project-specific includes
 #include "common/AidanGLCamera.h"
-#include "common/LoadShaders.h"
 #include "common/UsefulFunctions.h"
+#include "common/CPUParticleSim.h"
+#include "common/WorkGroupTuner.h"
+#include "common/HeadlessContext.h"
+#include "common/Benchmark.h"
+#include "common/GPUTimer.h"
+#include "common/UniformRing.h"
+#include "common/ColorLUT.h"
+#include "common/CompactParticles.h"
+#include "common/InitialConditions.h"
+#include "common/BufferPool.h"
+#include "common/ParticleSnapshot.h"
+#include "common/ComputeDispatch.h"
+#include "common/ProgramCache.h"
+#include "common/StartupTimer.h"
+#include "common/ShaderSource.h"
+
+// Every shaders/*.glsl, generated by the makefile
+#include "shaders/EmbeddedShaders.h"
 
 // TODOs:
 //  ****Randomize starting positions/velocities
-//  ***Switch between CPU and GPU computation
 //  **CMAKE project
 //  *Functionalize reference creation and checking in initGlobals()
 //  Include air resistance
-//  Add adjustable workgroup size
 //  Add bouncy cylinders
 //  Add rotation to floor plane
 //  Sphereoids? Might be better to do in object-space, might not.
@@ -45,219 +64,612 @@
 //  Functionalize SSBO generation. Shouldn't be *too* annoying, save lines of code.
 //      It'll have no positive performance impact though
 
-int NUM_PARTICLES = 1500 * 1500; // total number of particles to move
-int WORK_GROUP_SIZE = 100;       // # work-items per work-group
+size_t NUM_PARTICLES = 1500 * 1500; // total number of particles to move
+int WORK_GROUP_SIZE = 100;       // # work-items per work-group, picked by workGroupTuner at startup
 
 // create references to SSBO's for these data
-GLuint posSSbo;
-GLuint velSSbo;
-GLuint colSSbo;
+// The particles are split into shards of up to shardParticles, each with its own position,
+// velocity and color SSBO, so no single binding has to hold more than the driver allows.
+// Usually that's just one shard. Shard i holds particles [i * shardParticles, ...)
+struct ParticleShard {
+    GLuint posSSbo, velSSbo, colSSbo;   // colSSbo is 0 while colorFromVelocity is set
+    int posSlot, velSlot, colSlot;      // in bufferPool
+    // cull.glsl's buffers, all 0 while frustumCulling is off: the visible particles' indices,
+    // per work group counts/offsets, the glDrawArraysIndirect command drawn with, the
+    // per invocation visibility bits it passes from one pass to the next, and the
+    // per block bounding boxes compute.glsl keeps for it
+    GLuint visibleSSbo, groupSSbo, commandBuffer, maskSSbo, boundsSSbo;
+    int visibleSlot, groupSlot, commandSlot, maskSlot, boundsSlot;
+};
+std::vector<ParticleShard> shards;      // only the first shardCount() are in use
+size_t shardParticles = 0;              // from GL_MAX_SHADER_STORAGE_BLOCK_SIZE, or --shard-particles
+
+// Fixed point cube for compactStorage, picked from the sphere when the SSBOs are made
+glm::vec4 compactBox;
+
+// Low- to high-speed color table vert.glsl reads in colorFromVelocity mode
+ColorLUT colorLUT;
+
+// GPU time of every pass, shown as graphs in the Settings window
+enum GPUPass { PASS_SIMULATE, PASS_SORT, PASS_CULL, PASS_DRAW, PASS_UI, NUM_PASSES };
+const char *gpuPassNames[NUM_PASSES + 1] = {"Compute", "Sort", "Cull", "Draw", "ImGui", "Whole frame"};
+GPUTimer gpuTimer;
+
+// Command line options, see parseArgs()
+bool headless = false;                  // no window, run on an EGL/OSMesa context instead
+bool headlessRender = true;             // still draw every frame, into an offscreen framebuffer
+bool startOnCPU = false;
+int headlessFrames = 600;               // frames to run before exiting
+int headlessWidth = 1280, headlessHeight = 720;
+float headlessDT = 1.0f / 60.0f;        // fixed frame time, so headless runs are repeatable
+const char *screenshotPath = NULL;      // where to save the last headless frame, if anywhere
+double headlessClock = 0.0;             // seconds of simulated frame time so far
+bool benchmark = false;                 // sweep sizes/backends/variants and write a JSON report
+std::vector<size_t> benchSizes;            // particle counts to sweep, defaults in parseArgs()
+int benchWarmup = 3, benchTrials = 10;
+const char *benchOutput = "bench.json";
+bool colorFromVelocity = false;         // vert.glsl colors particles from a LUT, no Col buffer at all
+bool compactStorage = false;            // fixed point positions and half float velocities, 8 B each
+bool frustumCulling = true;             // draw only what cull.glsl finds on screen, see cullParticles()
+bool blockBoundsValid = false;          // the block bounds are of the particles as they are now
+bool spatialSorting = true;             // keep the particles in Morton order, see keepParticlesSorted()
+int sortInterval = 0;                   // steps between sorts no matter what, 0 for only when disordered
+float sortThreshold = 0.5f;             // how far back to random order they can get, see keepParticlesSorted()
+// What initSSBOs() starts the particles out as, see InitialConditions.h
+InitialConditions initialConditions = defaultInitialConditions(DIST_BALL);
+bool gpuSeeding = true;                 // generate them with seed.glsl instead of on the CPU
+bool keepSnapshot = true;               // keep a GPU copy of them, so Restart is just a copy
+
+// Every particle buffer lives in a pool slot, the pool keeps track of how much GPU memory
+// they take. Shards get their slots as they're made, see reserveShards()
+BufferPool bufferPool;
+
+// The initial particles, as last seeded, see seedParticles()
+ParticleSnapshot snapshot(bufferPool);
+
+// CPU backend, only steps particles while cpuCompute is set.
+// Its worker pool also does any seeding on the CPU
+CPUParticleSim cpuSim;
+// One thread per core, with transparent huge pages. Threads are only pinned when asked
+//  to (--pin), a shared cgroup or cpuset may not leave us the cores pinning assumes
+CPUSimConfig cpuConfig = {0, false, HUGEPAGES_TRANSPARENT};
+
+// --cpu-seed startup generates the particles on cpuSim's workers while the context comes up
+ParticlePregenerator pregenerator(cpuSim);
+
+// Where startup time goes, printed once the first frames are up
+StartupTimer startupTimer;
+bool tuneOnStartup = false;             // no tuned work group size yet, see finishStartup()
 
 // Declaration of Camera object
 Camera camera = Camera();
 
+// Times compute.glsl with different local sizes, remembers the winner per device
+WorkGroupTuner workGroupTuner;
+
 // Disgusting number of global variables.
 // TODO: Cleanup with code cleanup.
 int windowWidth, windowHeight, windowSizeX, windowSizeY;
 int boundingSphereEnable, floorEnable;
-int numParticlesTemp;
+unsigned long long numParticlesTemp;    // ImGuiDataType_U64, so the UI can ask for over 2^31
 float cameraSpeed, mouseSensitivity, horizontalAngle, verticalAngle, initialFoV;
 float particleSize, colorSpeed, colorScale;
 float simulationSpeed, blackHoleGravity, blackHoleSpeed, blackHoleYcoord, blackHoleXcoord;
 float blackHoleZcoord, blackHoleXZDisp, blackHoleYDisp, floorPos;
 bool userCameraInput, runSim, floorCheckBoxFlag;
-bool sphereCheckBoxFlag;
+bool sphereCheckBoxFlag, cpuCompute, cpuCheckBoxFlag;
 glm::vec3 cameraPosition, startColorA, startColorB, endColorA, endColorB;
 glm::vec4 sphere;
 ImVec4 clearColor;
 GLuint renderShader, computeShader, vao;
+GLuint computeVariants[4];
+GLuint seedShader;
+GLuint cullShaders[3];                  // cull.glsl's three passes
+const int CULL_GROUP_SIZE = 256;        // invocations per cull.glsl work group
+const int CULL_PER_THREAD = 8;          // particles per invocation
+const int CULL_GROUP_PARTICLES = CULL_GROUP_SIZE * CULL_PER_THREAD;
+// Particles per block bounding box, see bounds.glsl. A compute.glsl work group
+// (WORK_GROUP_CANDIDATES) and a cull.glsl invocation must fit in one
+const int BLOCK_PARTICLES = 1024;
+static_assert(CULL_GROUP_PARTICLES % BLOCK_PARTICLES == 0, "cull.glsl work groups must cover whole blocks");
+// sort.glsl's passes, numbered like its SORT_PASS
+enum SortPass { SORT_BOUNDS, SORT_KEYS, SORT_COUNT, SORT_SCAN, SORT_SCATTER, SORT_GATHER, SORT_DISORDER, NUM_SORT_PASSES };
+GLuint sortShaders[NUM_SORT_PASSES];    // SORT_GATHER moves position/velocity sized particles
+GLuint sortColorShader;                 // SORT_GATHER for the colors
+const int SORT_GROUP_SIZE = 256;        // invocations per sort.glsl work group
+const int SORT_PER_THREAD = 8;          // keys per invocation when counting and scattering
+const int SORT_GROUP_PARTICLES = SORT_GROUP_SIZE * SORT_PER_THREAD;
+static_assert(SORT_GROUP_PARTICLES < 65536, "sort.glsl counts a work group's digits in 16 bits");
+const int SORT_RADIX = 16;              // 4 bits a round, 8 rounds for the 30-bit keys
+const int SORT_CHECK_INTERVAL = 60;     // steps between disorder measurements
+// sort.glsl's buffers. Shards are sorted one at a time, so they share them: two sets of
+// (index, key) pairs each round reads one of and writes the other, the per work group
+// digit counts, and room for one attribute in its new order. Only held while sorting.
+// The box the keys are made in and the disorder sum stay, the sum is read back some
+// steps after it's written
+int sortIndexSlots[2], sortKeySlots[2], sortCountSlot, sortScratchSlot, sortStateSlot;
+const int SORT_STATE_UINTS = 8;         // sort.glsl's SortState, padded
+GLsync disorderFence = 0;               // measureDisorder()'s sum is ready once this signals
+bool disorderOfSorted = false;          // the pending measurement is of freshly sorted particles
+size_t disorderPairs = 0;               // particle pairs the sum is over
+float lastDisorder = -1.0f;             // last one read back, about 1 in random order, -1 before the first
+float sortedDisorder = 0.0f;            // what it was right after the last sort
+int sortSteps = 0;                      // since the last sort
+int checkSteps = SORT_CHECK_INTERVAL;   // since the last measurement, the first step measures
+int sortCount = 0;                      // sorts so far
+float lastSortMs = 0.0f;                // GPU time of the last one the timer has read back
 glm::mat4 viewMatrix, projectionMatrix;
-GLint viewMatRef, projMatRef, BH1Ref, BH2Ref, sphereRef, DTRef, particleSizeRef;
-GLint BHGravityRef, sphereEnableRef, floorEnableRef, colorScaleRef, startColorRef;
-GLint endColorRef, bouncingRef, floorPosRef;
 
-GLuint createComputeShader(const char *compute_file_path)
+// std140 mirrors of the uniform blocks in compute.glsl and vert.glsl.
+// Members are ordered so nothing needs implicit padding, the explicit padding
+//  keeps the sizes a multiple of 16 like std140 wants
+struct SimUniforms {
+    glm::vec3 blackHole1;
+    float blackHoleAccel;
+    glm::vec3 blackHole2;
+    float DT;
+    glm::vec3 startColor;
+    float colorScale;
+    glm::vec3 endColor;
+    float floorPos;
+    glm::vec4 sphere;
+    glm::vec4 compactBox;
+    GLuint particleCount;
+    GLuint padding[3];
+};
+struct RenderUniforms {
+    glm::mat4 viewMat;
+    glm::mat4 projMat;
+    glm::vec4 compactBox;
+    float particleSizeScalar;
+    float colorScale;
+    glm::vec2 viewportSize;
+};
+// Settings for seed.glsl, see seedParticlesOnGPU()
+struct SeedUniforms {
+    glm::vec4 compactBox;
+    float radius;
+    float speed;
+    float centralAccel;
+    float separation;
+    float approachSpeed;
+    GLuint seed;
+    GLuint distribution;
+    GLuint particleCount;
+    GLuint firstParticle;
+    GLuint particleBase;
+    GLuint particleBaseHigh;
+    GLuint padding;
+};
+// One shard's worth of work for cull.glsl, see cullParticles()
+struct CullUniforms {
+    GLuint particleCount;
+    GLuint groupCount;
+    GLuint useBlockBounds;
+    GLuint padding;
+};
+static_assert(sizeof(SimUniforms) == 112, "SimUniforms must match the std140 layout in compute.glsl");
+static_assert(sizeof(RenderUniforms) == 160, "RenderUniforms must match the std140 layout in camera.glsl");
+static_assert(sizeof(SeedUniforms) == 64, "SeedUniforms must match the std140 layout in seed.glsl");
+// One shard and round's worth of work for sort.glsl, see sortParticles()
+struct SortUniforms {
+    glm::vec4 compactBox;
+    GLuint particleCount;
+    GLuint groupCount;
+    GLuint shift;
+    GLuint padding;
+};
+static_assert(sizeof(CullUniforms) == 16, "CullUniforms must match the std140 layout in cull.glsl");
+static_assert(sizeof(SortUniforms) == 32, "SortUniforms must match the std140 layout in sort.glsl");
+
+// All the blocks live in one persistently mapped ring, see UniformRing.h
+UniformRing uniformRing;
+int simUniformBlock, renderUniformBlock, seedUniformBlock, cullUniformBlock, sortUniformBlock;
+
+// Shader files and their #includes, built in unless --shader-dir says otherwise
+ShaderLibrary shaderLibrary(embeddedShaders, sizeof(embeddedShaders) / sizeof(embeddedShaders[0]));
+
+// Linked programs from earlier runs, see ProgramCache.h. Keyed by the final source,
+//  so editing a shader or changing a #define just misses
+ProgramCache programCache;
+
+// A program handed to the driver that hasn't been checked yet.
+// With GL_KHR_parallel_shader_compile the driver compiles and links on threads of its own,
+//  and only asking for the result waits. So everything startup needs is started at once
+//  and finished in the order it's needed, see startProgram() and finishProgram()
+struct PendingProgram {
+    GLuint *target;                     // gets the program once it's checked
+    GLuint program;
+    std::vector<GLuint> shaders;
+    std::vector<std::string> files;     // for the error messages, one line per stage
+    std::string cacheKey;
+    std::string variantKey;             // empty if it isn't kept in programVariants
+};
+std::vector<PendingProgram> pendingPrograms;
+
+// Every program built from a set of files and defines, kept as long as the context.
+// Switching back to a variant that was built before is then free.
+// Keyed by file names and defines, see variantKey()
+std::map<std::string, GLuint> programVariants;
+
+void enableParallelShaderCompile()
 {
-    // On the C++ side, creating a compute shader works exactly like other shaders
-    // Create shader, store reference
-    GLuint ComputeShaderID = glCreateShader(GL_COMPUTE_SHADER);
+    // Let the driver use as many compiler threads as it likes
+    if (GLEW_KHR_parallel_shader_compile)
+    {
+        glMaxShaderCompilerThreadsKHR(0xFFFFFFFF);
+    }
+    else if (GLEW_ARB_parallel_shader_compile)
+    {
+        glMaxShaderCompilerThreadsARB(0xFFFFFFFF);
+    }
+}
+
+void discardProgram(size_t index)
+{
+    // Throw away a pending program nobody wants anymore
+    PendingProgram &pending = pendingPrograms[index];
+    for (size_t i = 0; i < pending.shaders.size(); i++)
+    {
+        glDeleteShader(pending.shaders[i]);
+    }
+    glDeleteProgram(pending.program);
+    pendingPrograms.erase(pendingPrograms.begin() + index);
+}
 
-    // Parse shader string
-    std::string ComputeShaderCode;
-    std::ifstream ComputeShaderStream(compute_file_path, std::ios::in);
-    if (ComputeShaderStream.is_open())
+std::string stageName(GLenum stage)
+{
+    switch (stage)
     {
-        std::stringstream sstr;
-        sstr << ComputeShaderStream.rdbuf();
-        ComputeShaderCode = sstr.str();
-        ComputeShaderStream.close();
+    case GL_VERTEX_SHADER:
+        return "vertex";
+    case GL_GEOMETRY_SHADER:
+        return "geometry";
+    case GL_FRAGMENT_SHADER:
+        return "fragment";
+    default:
+        return "compute";
     }
-    else
+}
+
+std::string variantKey(const std::vector<GLenum> &stages, const std::vector<std::string> &files, const ShaderDefines &defines)
+{
+    // What programVariants tells programs apart by
+    std::string key;
+    for (size_t i = 0; i < stages.size(); i++)
+    {
+        key += stageName(stages[i]) + " " + files[i] + "\n";
+    }
+    return key + defines.str();
+}
+
+void startProgram(GLuint *target, const std::vector<GLenum> &stages, const std::vector<std::string> &files,
+                  const ShaderDefines &defines, bool keepVariant = true)
+{
+    // Compile and link one program from shaderLibrary files (one per stage), every stage
+    // gets defines. Nothing here waits for the driver: *target stays 0 until finishProgram(target)
+    // A program still pending for the same target is replaced.
+    // Kept variants belong to programVariants and must not be deleted, with keepVariant
+    // false the program is the caller's
+    for (size_t i = 0; i < pendingPrograms.size(); i++)
+    {
+        if (pendingPrograms[i].target == target)
+        {
+            discardProgram(i);
+            break;
+        }
+    }
+    *target = 0;
+
+    // Built before, nothing to do at all
+    std::string key = variantKey(stages, files, defines);
+    if (keepVariant && programVariants.count(key) != 0)
+    {
+        *target = programVariants[key];
+        return;
+    }
+
+    std::vector<std::string> sources(stages.size());
+    std::vector<std::string> fileLists(stages.size());
+    std::string cacheKey;
+    for (size_t i = 0; i < stages.size(); i++)
+    {
+        std::vector<std::string> included;
+        if (!shaderLibrary.preprocess(files[i], defines, sources[i], included))
+        {
+            return;
+        }
+        cacheKey += stageName(stages[i]) + "\n" + sources[i];
+        // Compiler messages number the files, 0 is files[i] itself
+        fileLists[i] = files[i];
+        for (size_t j = 1; j < included.size(); j++)
+        {
+            std::ostringstream number;
+            number << j;
+            fileLists[i] += (j == 1 ? " (" : ", ") + number.str() + ": " + included[j] + (j + 1 == included.size() ? ")" : "");
+        }
+    }
+
+    // Skip compiling altogether if this exact program was linked before
+    *target = programCache.load(cacheKey);
+    if (*target != 0)
+    {
+        if (keepVariant)
+        {
+            programVariants[key] = *target;
+        }
+        return;
+    }
+
+    PendingProgram pending;
+    pending.target = target;
+    pending.program = glCreateProgram();
+    pending.files = fileLists;
+    pending.cacheKey = cacheKey;
+    pending.variantKey = keepVariant ? key : "";
+    for (size_t i = 0; i < stages.size(); i++)
+    {
+        // Read shader as c_string, into a new shader, and compile
+        GLuint ShaderID = glCreateShader(stages[i]);
+        char const *SourcePointer = sources[i].c_str();
+        glShaderSource(ShaderID, 1, &SourcePointer, NULL);
+        glCompileShader(ShaderID);
+        glAttachShader(pending.program, ShaderID);
+        pending.shaders.push_back(ShaderID);
+    }
+    // Linking straight away is fine, a stage that didn't compile just fails the link
+    programCache.prepare(pending.program);
+    glLinkProgram(pending.program);
+    pendingPrograms.push_back(pending);
+}
+
+void finishProgram(GLuint *target)
+{
+    // Wait for the program started for target, if there is one, check it and hand it over
+    size_t index = 0;
+    while (index < pendingPrograms.size() && pendingPrograms[index].target != target)
     {
-        printf("Impossible to open %s. Are you in the right directory ? Don't forget to read the FAQ !\n", compute_file_path);
-        getchar();
-        return 0;
+        index++;
     }
+    if (index == pendingPrograms.size())
+    {
+        return;
+    }
+    PendingProgram pending = pendingPrograms[index];
+    pendingPrograms.erase(pendingPrograms.begin() + index);
 
     // Init result variables to check return values
     GLint Result = GL_FALSE;
     int InfoLogLength;
 
-    // Compile Compute Shader
-    // Read shader as c_string
-    char const *ComputeSourcePointer = ComputeShaderCode.c_str();
-    // Read shader source into ComputeShaderID
-    glShaderSource(ComputeShaderID, 1, &ComputeSourcePointer, NULL);
-    // Compile shader
-    glCompileShader(ComputeShaderID);
-
-    // Check Compute Shader
+    // Check every shader
     // These functions get the requested shader information
-    glGetShaderiv(ComputeShaderID, GL_COMPILE_STATUS, &Result);
-    glGetShaderiv(ComputeShaderID, GL_INFO_LOG_LENGTH, &InfoLogLength);
-    if (InfoLogLength > 0)
+    for (size_t i = 0; i < pending.shaders.size(); i++)
     {
-        std::vector<char> ComputeShaderErrorMessage(InfoLogLength + 1);
-        glGetShaderInfoLog(ComputeShaderID, InfoLogLength, NULL, &ComputeShaderErrorMessage[0]);
-        printf("Compiling shader : %s\n", compute_file_path);
-        printf("%s\n", &ComputeShaderErrorMessage[0]);
+        glGetShaderiv(pending.shaders[i], GL_COMPILE_STATUS, &Result);
+        glGetShaderiv(pending.shaders[i], GL_INFO_LOG_LENGTH, &InfoLogLength);
+        if (InfoLogLength > 0)
+        {
+            std::vector<char> ShaderErrorMessage(InfoLogLength + 1);
+            glGetShaderInfoLog(pending.shaders[i], InfoLogLength, NULL, &ShaderErrorMessage[0]);
+            printf("Compiling shader : %s\n", pending.files[i].c_str());
+            printf("%s\n", &ShaderErrorMessage[0]);
+        }
     }
 
-    // Link the program
-    GLuint ProgramID = glCreateProgram();
-    glAttachShader(ProgramID, ComputeShaderID);
-    glLinkProgram(ProgramID);
-
     // Check the program
-    glGetProgramiv(ProgramID, GL_LINK_STATUS, &Result);
-    glGetProgramiv(ProgramID, GL_INFO_LOG_LENGTH, &InfoLogLength);
+    glGetProgramiv(pending.program, GL_LINK_STATUS, &Result);
+    glGetProgramiv(pending.program, GL_INFO_LOG_LENGTH, &InfoLogLength);
     if (InfoLogLength > 0)
     {
         std::vector<char> ProgramErrorMessage(InfoLogLength + 1);
-        glGetProgramInfoLog(ProgramID, InfoLogLength, NULL, &ProgramErrorMessage[0]);
+        glGetProgramInfoLog(pending.program, InfoLogLength, NULL, &ProgramErrorMessage[0]);
         printf("Linking program\n");
         printf("%s\n", &ProgramErrorMessage[0]);
     }
 
     // Cleanup
-    glDetachShader(ProgramID, ComputeShaderID);
-    glDeleteShader(ComputeShaderID);
+    for (size_t i = 0; i < pending.shaders.size(); i++)
+    {
+        glDetachShader(pending.program, pending.shaders[i]);
+        glDeleteShader(pending.shaders[i]);
+    }
+    programCache.save(pending.cacheKey, pending.program);
+    *pending.target = pending.program;
+    if (!pending.variantKey.empty())
+    {
+        programVariants[pending.variantKey] = pending.program;
+    }
+}
+
+void finishPrograms()
+{
+    // Everything started, in the order it was started
+    while (!pendingPrograms.empty())
+    {
+        finishProgram(pendingPrograms[0].target);
+    }
+}
 
+GLuint createComputeShader(const char *compute_file, const ShaderDefines &defines)
+{
+    // On the C++ side, creating a compute shader works exactly like other shaders
+    // Not kept in programVariants, the caller deletes it
+    GLuint ProgramID = 0;
+    startProgram(&ProgramID, std::vector<GLenum>(1, GL_COMPUTE_SHADER), std::vector<std::string>(1, compute_file), defines, false);
+    finishProgram(&ProgramID);
     return ProgramID;
 }
 
-GLuint createShaders(const char *vertex_file_path, const char *fragment_file_path)
+int computeVariantIndex(int sphereOn, int floorOn)
 {
-    GLuint VertexShaderID = glCreateShader(GL_VERTEX_SHADER);
-    GLuint FragmentShaderID = glCreateShader(GL_FRAGMENT_SHADER);
+    // Which of computeVariants has exactly these collisions compiled in
+    return (sphereOn ? 1 : 0) | (floorOn ? 2 : 0);
+}
 
-    // Read the Vertex Shader code from the file
-    // This part is just reading from a file, nothing to do with computer graphics
-    // This is always so fiddly, I really don't mind copy/pasting from the tutorial
-    // even if I would do it differently.
-    // http://www.opengl-tutorial.org/beginners-tutorials/tutorial-2-the-first-triangle/
-    std::string VertexShaderCode;
-    std::ifstream VertexShaderStream(vertex_file_path, std::ios::in);
-    if (VertexShaderStream.is_open())
+SimParams computeSimParams(float deltaTime);
+void updateComputeShader(const SimParams &params, GLuint particleCount);
+
+ShaderDefines computeDefines(int variant, int workGroupSize, bool blockBounds = true)
+{
+    // Everything compute.glsl gets #defined for one variant
+    // blockBounds false leaves the block bounds out even when culling, for kernels run
+    // on particles other than the shards'
+    ShaderDefines defines;
+    defines.set("WORK_GROUP_SIZE", workGroupSize);
+    if (variant & 1)
     {
-        std::stringstream sstr;
-        sstr << VertexShaderStream.rdbuf();
-        VertexShaderCode = sstr.str();
-        VertexShaderStream.close();
+        defines.set("SPHERE_ENABLE");
     }
-    else
+    if (variant & 2)
     {
-        printf("Impossible to open %s. Are you in the right directory ? Don't forget to read the FAQ !\n", vertex_file_path);
-        getchar();
-        return 0;
+        defines.set("FLOOR_ENABLE");
     }
-    // Read the Fragment Shader code from the file
-    std::string FragmentShaderCode;
-    std::ifstream FragmentShaderStream(fragment_file_path, std::ios::in);
-    if (FragmentShaderStream.is_open())
+    if (colorFromVelocity)
     {
-        std::stringstream sstr;
-        sstr << FragmentShaderStream.rdbuf();
-        FragmentShaderCode = sstr.str();
-        FragmentShaderStream.close();
+        defines.set("COLOR_FROM_VELOCITY");
     }
-    else
+    if (compactStorage)
     {
-        printf("Impossible to open %s. Are you in the right directory ? Don't forget to read the FAQ !\n", fragment_file_path);
-        getchar();
-        return 0;
+        defines.set("COMPACT_STORAGE");
     }
-
-    // Init result variables to check return values
-    GLint Result = GL_FALSE;
-    int InfoLogLength;
-
-    // Compile Vertex Shader
-    // Read shader as c_string
-    char const *VertexSourcePointer = VertexShaderCode.c_str();
-    // Read shader source into VertexShaderID
-    glShaderSource(VertexShaderID, 1, &VertexSourcePointer, NULL);
-    // Compile shader
-    glCompileShader(VertexShaderID);
-
-    // Check Vertex Shader
-    // These functions get the requested shader information
-    glGetShaderiv(VertexShaderID, GL_COMPILE_STATUS, &Result);
-    glGetShaderiv(VertexShaderID, GL_INFO_LOG_LENGTH, &InfoLogLength);
-    if (InfoLogLength > 0)
+    // Only cull.glsl has any use for the block bounds
+    if (frustumCulling && blockBounds)
     {
-        std::vector<char> VertexShaderErrorMessage(InfoLogLength + 1);
-        glGetShaderInfoLog(VertexShaderID, InfoLogLength, NULL, &VertexShaderErrorMessage[0]);
-        printf("Compiling shader : %s\n", vertex_file_path);
-        printf("%s\n", &VertexShaderErrorMessage[0]);
+        defines.set("BLOCK_BOUNDS").set("BLOCK_PARTICLES", BLOCK_PARTICLES);
     }
+    return defines;
+}
 
-    // Compile Fragment Shader
-    // Same steps as vertex shader
-    // TODO: condense into a single function or loop maybe?
-    char const *FragmentSourcePointer = FragmentShaderCode.c_str();
-    glShaderSource(FragmentShaderID, 1, &FragmentSourcePointer, NULL);
-    glCompileShader(FragmentShaderID);
-
-    // Check Fragment Shader
-    glGetShaderiv(FragmentShaderID, GL_COMPILE_STATUS, &Result);
-    glGetShaderiv(FragmentShaderID, GL_INFO_LOG_LENGTH, &InfoLogLength);
-    if (InfoLogLength > 0)
+void startComputeVariants()
+{
+    // Build compute.glsl once per sphere/floor combination, so the shader never has to
+    // check the checkboxes per particle. Swapping variants is then just picking a program
+    // Started again whenever WORK_GROUP_SIZE changes, the local size is baked in too
+    // The seeding pass writes the same buffer layout, so it's rebuilt along with them.
+    // It goes first, the particles need it before anything needs a variant
+    // Variants built before (the other storage layout, say) come straight from programVariants
+    startProgram(&seedShader, std::vector<GLenum>(1, GL_COMPUTE_SHADER), std::vector<std::string>(1, "seed.glsl"),
+                 computeDefines(0, WORK_GROUP_SIZE));
+    for (int variant = 0; variant < 4; variant++)
+    {
+        startProgram(&computeVariants[variant], std::vector<GLenum>(1, GL_COMPUTE_SHADER), std::vector<std::string>(1, "compute.glsl"),
+                     computeDefines(variant, WORK_GROUP_SIZE));
+    }
+    // sort.glsl reads the positions in the same layout and gathers particles the size
+    // they are in it (particleBytes()), plus the colors if there's a Col buffer.
+    // One program per pass
+    ShaderDefines sortDefines;
+    if (colorFromVelocity)
+    {
+        sortDefines.set("COLOR_FROM_VELOCITY");
+    }
+    if (compactStorage)
     {
-        std::vector<char> FragmentShaderErrorMessage(InfoLogLength + 1);
-        glGetShaderInfoLog(FragmentShaderID, InfoLogLength, NULL, &FragmentShaderErrorMessage[0]);
-        printf("Compiling shader : %s\n", fragment_file_path);
-        printf("%s\n", &FragmentShaderErrorMessage[0]);
+        sortDefines.set("COMPACT_STORAGE");
     }
+    sortDefines.set("SORT_GROUP_SIZE", SORT_GROUP_SIZE).set("SORT_PER_THREAD", SORT_PER_THREAD);
+    for (int pass = 0; pass < NUM_SORT_PASSES; pass++)
+    {
+        ShaderDefines passDefines = sortDefines;
+        passDefines.set("SORT_PASS", pass);
+        if (pass == SORT_GATHER)
+        {
+            passDefines.set("SORT_WORDS", compactStorage ? COMPACT_UINTS_PER_PARTICLE : 4);
+        }
+        startProgram(&sortShaders[pass], std::vector<GLenum>(1, GL_COMPUTE_SHADER), std::vector<std::string>(1, "sort.glsl"),
+                     passDefines);
+    }
+    sortDefines.set("SORT_PASS", SORT_GATHER).set("SORT_WORDS", 4);
+    startProgram(&sortColorShader, std::vector<GLenum>(1, GL_COMPUTE_SHADER), std::vector<std::string>(1, "sort.glsl"),
+                 sortDefines);
+}
 
-    // Link the program
-    GLuint ProgramID = glCreateProgram();
-    glAttachShader(ProgramID, VertexShaderID);
-    glAttachShader(ProgramID, FragmentShaderID);
-    glLinkProgram(ProgramID);
+void createComputeVariants()
+{
+    startComputeVariants();
+    finishPrograms();
+    computeShader = computeVariants[computeVariantIndex(boundingSphereEnable, floorEnable)];
+}
 
-    // Check the program
-    glGetProgramiv(ProgramID, GL_LINK_STATUS, &Result);
-    glGetProgramiv(ProgramID, GL_INFO_LOG_LENGTH, &InfoLogLength);
-    if (InfoLogLength > 0)
+void startRenderShader()
+{
+    // vert.glsl either reads the Col buffer or works colors out from the velocity,
+    // and reads whichever layout the position and velocity buffers are in
+    ShaderDefines defines;
+    if (colorFromVelocity)
     {
-        std::vector<char> ProgramErrorMessage(InfoLogLength + 1);
-        glGetProgramInfoLog(ProgramID, InfoLogLength, NULL, &ProgramErrorMessage[0]);
-        printf("Linking program\n");
-        printf("%s\n", &ProgramErrorMessage[0]);
+        defines.set("COLOR_FROM_VELOCITY").set("COLOR_LUT_SIZE", COLOR_LUT_SIZE);
+    }
+    if (compactStorage)
+    {
+        defines.set("COMPACT_STORAGE");
+    }
+    // cull.glsl reads positions in the same layout, and its block declarations need to
+    // know whether there's a Col buffer. One program per pass
+    for (int pass = 0; pass < 3; pass++)
+    {
+        ShaderDefines cullDefines = defines;
+        cullDefines.set("CULL_GROUP_SIZE", CULL_GROUP_SIZE).set("CULL_PER_THREAD", CULL_PER_THREAD).set("CULL_PASS", pass);
+        cullDefines.set("BLOCK_PARTICLES", BLOCK_PARTICLES);
+        startProgram(&cullShaders[pass], std::vector<GLenum>(1, GL_COMPUTE_SHADER), std::vector<std::string>(1, "cull.glsl"),
+                     cullDefines);
+    }
+    if (frustumCulling)
+    {
+        defines.set("CULLED");
     }
+    std::vector<GLenum> stages;
+    stages.push_back(GL_VERTEX_SHADER);
+    stages.push_back(GL_FRAGMENT_SHADER);
+    std::vector<std::string> files;
+    files.push_back("vert.glsl");
+    files.push_back("frag.glsl");
+    startProgram(&renderShader, stages, files, defines);
+}
 
-    // Cleanup
-    glDetachShader(ProgramID, VertexShaderID);
-    glDetachShader(ProgramID, FragmentShaderID);
-    glDeleteShader(VertexShaderID);
-    glDeleteShader(FragmentShaderID);
+void createRenderShader()
+{
+    startRenderShader();
+    finishPrograms();
+}
 
-    // printf("Vertex Shader source:\n%s\n", VertexShaderCode.c_str());
-    // printf("Geometry Shader source:\n%s\n", GeometryShaderCode.c_str());
-    // printf("Fragment Shader source:\n%s\n", FragmentShaderCode.c_str());
+void tuneWorkGroupSize()
+{
+    // Time every local size the driver allows on the full compute variant
+    // and rebuild the variants with the fastest one
+    printf("Tuning compute work group size...\n");
+    SimParams params = computeSimParams(0.0f);
+    // A zero timestep would still do all the math, but a normal one is more honest
+    params.DT = simulationSpeed / 60.0f;
+    int best = workGroupTuner.tune(
+        [](int size) {
+            // The tuner steps scratch particles of its own, binding 11 is still a shard's
+            // bounds buffer and too small for them
+            return createComputeShader("compute.glsl", computeDefines(computeVariantIndex(1, 1), size, false));
+        },
+        [&](GLuint particleCount) {
+            updateComputeShader(params, particleCount);
+        },
+        (int)std::min(NUM_PARTICLES, (size_t)INT_MAX));
+    const std::vector<std::pair<int, double> > &times = workGroupTuner.getTimes();
+    for (size_t i = 0; i < times.size(); i++)
+    {
+        printf("  %4d: %.3f ms\n", times[i].first, times[i].second);
+    }
+    if (best > 0)
+    {
+        WORK_GROUP_SIZE = best;
+        printf("Using work group size %d\n", WORK_GROUP_SIZE);
+    }
+    createComputeVariants();
+}
 
-    return ProgramID;
+void initCPUBackend()
+{
+    // Start CPU worker threads as configured by --cpu-threads, --pin and --huge-pages.
+    // Done before anything else, CPU seeding runs on them too
+    cpuSim.init(cpuConfig);
 }
 
 void initGlobals()
@@ -271,8 +683,18 @@ void initGlobals()
     initialFoV = 62.0f;                        // initial camera field of view
     cameraPosition = glm::vec3(0.0f, 500.0f, -1800.0f); // initial camera position
     particleSize = 1000.0f;
-    renderShader = createShaders("shaders/vert.glsl", "shaders/frag.glsl");
-    computeShader = createComputeShader("shaders/compute.glsl");
+    // Every program starts compiling now and is only waited for when it's first needed,
+    // the rest of startup carries on meanwhile. finishStartup() waits for whatever's left
+    enableParallelShaderCompile();
+    startRenderShader();
+    colorLUT.init();
+    // Work group size this device was tuned to last time, if it ever was
+    int cachedWorkGroupSize = workGroupTuner.lookup();
+    if (cachedWorkGroupSize > 0)
+    {
+        WORK_GROUP_SIZE = cachedWorkGroupSize;
+    }
+    startComputeVariants();
     colorSpeed = 0.0f;
     colorScale = 2.5f;
     simulationSpeed = 400.0f;
@@ -289,8 +711,12 @@ void initGlobals()
 
     numParticlesTemp = NUM_PARTICLES;
 
+    gpuTimer.init(NUM_PASSES);
+
     userCameraInput = true;
     runSim = false;
+    cpuCompute = startOnCPU;
+    cpuCheckBoxFlag = startOnCPU;
 
     startColorA = glm::vec3(0.0f, 0.0f, 0.8f);
     startColorB = glm::vec3(0.0f, 0.494f, 0.7843f);
@@ -299,230 +725,626 @@ void initGlobals()
 
     clearColor = ImVec4(0.05f, 0.05f, 0.05f, 1.0f);
     sphere = glm::vec4(0.0f, 0.0f, 0.0f, 1000.0f);
+    compactBox = compactBoxFor(sphere);
 
-    // TODO: create a function for this, 4 buggy lines -> 1 easy function call
-    // initialize viewMatrix reference in render shader
-    viewMatRef = glGetUniformLocation(renderShader, "viewMat");
-    if (viewMatRef < 0)
+    simUniformBlock = uniformRing.addBlock(0, sizeof(SimUniforms));
+    renderUniformBlock = uniformRing.addBlock(1, sizeof(RenderUniforms));
+    seedUniformBlock = uniformRing.addBlock(2, sizeof(SeedUniforms));
+    cullUniformBlock = uniformRing.addBlock(3, sizeof(CullUniforms));
+    sortUniformBlock = uniformRing.addBlock(4, sizeof(SortUniforms));
+    uniformRing.init();
+
+    // Only ever touched by the GPU, except the disorder sum read back into a variable
+    for (int i = 0; i < 2; i++)
     {
-        std::cerr << "couldn't find viewMatRef in shader\n";
+        sortIndexSlots[i] = bufferPool.addSlot(0);
+        sortKeySlots[i] = bufferPool.addSlot(0);
     }
-    // initialize viewMatrix reference in render shader
-    projMatRef = glGetUniformLocation(renderShader, "projMat");
-    if (projMatRef < 0)
+    sortCountSlot = bufferPool.addSlot(0);
+    sortScratchSlot = bufferPool.addSlot(0);
+    sortStateSlot = bufferPool.addSlot(0);
+
+    // First run on this device, finishStartup() finds out which work group size it likes
+    tuneOnStartup = cachedWorkGroupSize == 0;
+}
+
+void finishStartup()
+{
+    // The rest of what initGlobals() started: the compute variants, and tuning
+    finishPrograms();
+    computeShader = computeVariants[computeVariantIndex(1, 1)];
+    // Uniforms come from blocks with fixed bindings, nothing to look up.
+    // Just make sure the shaders actually have them
+    if (glGetUniformBlockIndex(renderShader, "RenderUniforms") == GL_INVALID_INDEX)
     {
-        std::cerr << "couldn't find projMatRef in shader\n";
+        std::cerr << "couldn't find RenderUniforms in shader\n";
     }
-    // initialize DT reference in compute shader
-    particleSizeRef = glGetUniformLocation(renderShader, "particleSizeScalar");
-    if (particleSizeRef < 0)
+    if (glGetUniformBlockIndex(computeShader, "SimUniforms") == GL_INVALID_INDEX)
     {
-        std::cerr << "couldn't find particleSizeRef in shader\n";
+        std::cerr << "couldn't find SimUniforms in shader\n";
     }
-    // initialize blackHole 1 reference in compute shader
-    BH1Ref = glGetUniformLocation(computeShader, "blackHole1");
-    if (BH1Ref < 0)
+    if (tuneOnStartup)
     {
-        std::cerr << "couldn't find BH1Ref in shader\n";
+        tuneWorkGroupSize();
     }
-    // initialize blackHole 2 reference in compute shader
-    BH2Ref = glGetUniformLocation(computeShader, "blackHole2");
-    if (BH2Ref < 0)
+    startupTimer.mark("compute shaders");
+}
+
+GLsizeiptr particleBytes()
+{
+    // Bytes per particle in the position and velocity buffers
+    return compactStorage ? COMPACT_PARTICLE_BYTES : sizeof(glm::vec4);
+}
+
+size_t shardCount()
+{
+    // Shards the particles take up right now
+    return (NUM_PARTICLES + shardParticles - 1) / shardParticles;
+}
+
+size_t shardSize(size_t shard)
+{
+    // Every shard is full except maybe the last
+    return std::min(shardParticles, NUM_PARTICLES - shard * shardParticles);
+}
+
+void chooseShardSize()
+{
+    // As many particles per shard as one SSBO binding can hold in the biggest layout (vec4s),
+    // so switching layouts never reshuffles the shards
+    if (shardParticles != 0)
     {
-        std::cerr << "couldn't find BH2Ref in shader\n";
+        return;
     }
-    // initialize sphere reference in compute shader
-    sphereRef = glGetUniformLocation(computeShader, "sphere");
-    if (sphereRef < 0)
+    GLint64 maxBlockSize = 0;
+    glGetInteger64v(GL_MAX_SHADER_STORAGE_BLOCK_SIZE, &maxBlockSize);
+    // glDrawArrays() counts in GLsizei
+    shardParticles = std::min((size_t)maxBlockSize / sizeof(glm::vec4), (size_t)INT_MAX);
+}
+
+bool reserveShards(size_t count, size_t keep)
+{
+    // Get buffers for count particles from the pool, keeping the first keep particles.
+    // They're only replaced when they have to grow, and then with some room to spare
+    // (see BufferPool.h). Shards past the end are freed.
+    // Returns false if some buffer couldn't grow, the particles are all still there then
+    size_t needed = (count + shardParticles - 1) / shardParticles;
+    bool fits = true;
+    // compute.glsl builds them again on its next step
+    blockBoundsValid = false;
+    for (size_t i = 0; i < std::max(needed, shards.size()); i++)
     {
-        std::cerr << "couldn't find BH2Ref in shader\n";
+        if (i == shards.size())
+        {
+            // The CPU backend maps all three
+            ParticleShard shard = ParticleShard();
+            shard.posSlot = bufferPool.addSlot(GL_MAP_READ_BIT | GL_MAP_WRITE_BIT);
+            shard.velSlot = bufferPool.addSlot(GL_MAP_READ_BIT | GL_MAP_WRITE_BIT);
+            shard.colSlot = bufferPool.addSlot(GL_MAP_READ_BIT | GL_MAP_WRITE_BIT);
+            // Only ever written and read by the GPU
+            shard.visibleSlot = bufferPool.addSlot(0);
+            shard.groupSlot = bufferPool.addSlot(0);
+            shard.commandSlot = bufferPool.addSlot(0);
+            shard.maskSlot = bufferPool.addSlot(0);
+            shard.boundsSlot = bufferPool.addSlot(0);
+            shards.push_back(shard);
+        }
+        ParticleShard &shard = shards[i];
+        if (i >= needed)
+        {
+            bufferPool.release(shard.posSlot);
+            bufferPool.release(shard.velSlot);
+            bufferPool.release(shard.colSlot);
+            shard.posSSbo = shard.velSSbo = shard.colSSbo = 0;
+            bufferPool.release(shard.visibleSlot);
+            bufferPool.release(shard.groupSlot);
+            bufferPool.release(shard.commandSlot);
+            bufferPool.release(shard.maskSlot);
+            bufferPool.release(shard.boundsSlot);
+            shard.visibleSSbo = shard.groupSSbo = shard.commandBuffer = shard.maskSSbo = shard.boundsSSbo = 0;
+            continue;
+        }
+        size_t first = i * shardParticles;
+        size_t particles = std::min(shardParticles, count - first);
+        size_t kept = keep > first ? std::min(keep - first, particles) : 0;
+        // Compact storage needs half the bytes, see CompactParticles.h
+        shard.posSSbo = bufferPool.reserve(shard.posSlot, particles * particleBytes(), kept * particleBytes());
+        shard.velSSbo = bufferPool.reserve(shard.velSlot, particles * particleBytes(), kept * particleBytes());
+        fits = fits && bufferPool.getCapacity(shard.posSlot) >= (GLsizeiptr)(particles * particleBytes()) &&
+               bufferPool.getCapacity(shard.velSlot) >= (GLsizeiptr)(particles * particleBytes());
+        // Colors from velocity don't need a buffer at all
+        if (colorFromVelocity)
+        {
+            bufferPool.release(shard.colSlot);
+            shard.colSSbo = 0;
+        }
+        else
+        {
+            shard.colSSbo = bufferPool.reserve(shard.colSlot, particles * sizeof(glm::vec4), kept * sizeof(glm::vec4));
+            fits = fits && bufferPool.getCapacity(shard.colSlot) >= (GLsizeiptr)(particles * sizeof(glm::vec4));
+        }
+        // Culling output is rewritten every frame, nothing in it is worth keeping
+        if (frustumCulling)
+        {
+            size_t groups = (particles + CULL_GROUP_PARTICLES - 1) / CULL_GROUP_PARTICLES;
+            shard.visibleSSbo = bufferPool.reserve(shard.visibleSlot, particles * sizeof(GLuint));
+            shard.groupSSbo = bufferPool.reserve(shard.groupSlot, groups * sizeof(GLuint));
+            size_t blocks = (particles + BLOCK_PARTICLES - 1) / BLOCK_PARTICLES;
+            // The command, then cull.glsl's block counts, which have to start at 0
+            shard.commandBuffer = bufferPool.reserve(shard.commandSlot, 8 * sizeof(GLuint));
+            glBindBuffer(GL_COPY_WRITE_BUFFER, shard.commandBuffer);
+            glClearBufferSubData(GL_COPY_WRITE_BUFFER, GL_R32UI, 0, 8 * sizeof(GLuint), GL_RED_INTEGER, GL_UNSIGNED_INT, NULL);
+            shard.boundsSSbo = bufferPool.reserve(shard.boundsSlot, blocks * 6 * sizeof(GLuint));
+            shard.maskSSbo = bufferPool.reserve(shard.maskSlot, groups * CULL_GROUP_SIZE * 2 * sizeof(GLuint));
+            fits = fits && bufferPool.getCapacity(shard.visibleSlot) >= (GLsizeiptr)(particles * sizeof(GLuint)) &&
+                   bufferPool.getCapacity(shard.groupSlot) >= (GLsizeiptr)(groups * sizeof(GLuint)) &&
+                   bufferPool.getCapacity(shard.maskSlot) >= (GLsizeiptr)(groups * CULL_GROUP_SIZE * 2 * sizeof(GLuint)) &&
+                   bufferPool.getCapacity(shard.boundsSlot) >= (GLsizeiptr)(blocks * 6 * sizeof(GLuint));
+        }
+        else
+        {
+            bufferPool.release(shard.visibleSlot);
+            bufferPool.release(shard.groupSlot);
+            bufferPool.release(shard.commandSlot);
+            bufferPool.release(shard.maskSlot);
+            bufferPool.release(shard.boundsSlot);
+            shard.visibleSSbo = shard.groupSSbo = shard.commandBuffer = shard.maskSSbo = shard.boundsSSbo = 0;
+        }
     }
-    // initialize floorPos reference in compute shader
-    floorPosRef = glGetUniformLocation(computeShader, "floorPos");
-    if (floorPosRef < 0)
+    return fits;
+}
+
+void bindShard(size_t shard)
+{
+    // Point the shaders' Pos, Vel and Col at one shard, and its block bounds when culling
+    // Just its particles are bound, the shaders size their arrays from the bound range
+    GLsizeiptr particles = shardSize(shard);
+    glBindBufferRange(GL_SHADER_STORAGE_BUFFER, 4, shards[shard].posSSbo, 0, particles * particleBytes());
+    glBindBufferRange(GL_SHADER_STORAGE_BUFFER, 5, shards[shard].velSSbo, 0, particles * particleBytes());
+    if (shards[shard].colSSbo != 0)
     {
-        std::cerr << "couldn't find floorPosRef in shader\n";
+        glBindBufferRange(GL_SHADER_STORAGE_BUFFER, 6, shards[shard].colSSbo, 0, particles * sizeof(glm::vec4));
     }
-    // initialize floorEnable reference in compute shader
-    floorEnableRef = glGetUniformLocation(computeShader, "floorEnable");
-    if (floorEnableRef < 0)
+    if (shards[shard].boundsSSbo != 0)
     {
-        std::cerr << "couldn't find floorEnableRef in shader\n";
+        GLsizeiptr blocks = (particles + BLOCK_PARTICLES - 1) / BLOCK_PARTICLES;
+        glBindBufferRange(GL_SHADER_STORAGE_BUFFER, 11, shards[shard].boundsSSbo, 0, blocks * 6 * sizeof(GLuint));
     }
-    // initialize blackHoleGravity reference in compute shader
-    BHGravityRef = glGetUniformLocation(computeShader, "blackHoleAccel");
-    if (BHGravityRef < 0)
+}
+
+void *mapSSBO(GLuint ssbo, GLsizeiptr bytesPerParticle, size_t first, size_t count, GLbitfield access)
+{
+    // Map count particles of one particle SSBO, starting at particle first of the buffer
+    // There's no color buffer to map in colorFromVelocity mode
+    if (ssbo == 0)
     {
-        std::cerr << "couldn't find BHGravityRef in shader\n";
+        return NULL;
     }
-    // initialize blackHoleGravity reference in compute shader
-    sphereEnableRef = glGetUniformLocation(computeShader, "sphereEnable");
-    if (sphereEnableRef < 0)
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, ssbo);
+    return glMapBufferRange(GL_SHADER_STORAGE_BUFFER, first * bytesPerParticle, count * bytesPerParticle, access);
+}
+
+void unmapSSBO(GLuint ssbo)
+{
+    if (ssbo == 0)
     {
-        std::cerr << "couldn't find sphereEnableRef in shader\n";
+        return;
     }
-    // initialize blackHoleGravity reference in compute shader
-    colorScaleRef = glGetUniformLocation(computeShader, "colorScale");
-    if (colorScaleRef < 0)
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, ssbo);
+    glUnmapBuffer(GL_SHADER_STORAGE_BUFFER);
+}
+
+std::vector<ParticleSpan> mapSSBOs(GLbitfield access, size_t first = 0)
+{
+    // Map particles first to NUM_PARTICLES, one span for every shard they're in
+    // Pool buffers can be bigger than the particles in them, only the particles are mapped
+    std::vector<ParticleSpan> spans;
+    for (size_t i = first / shardParticles; i < shardCount(); i++)
     {
-        std::cerr << "couldn't find colorScaleRef in shader\n";
+        size_t shardFirst = i * shardParticles;
+        ParticleSpan span;
+        span.first = std::max(first, shardFirst);
+        span.count = shardFirst + shardSize(i) - span.first;
+        size_t offset = span.first - shardFirst;
+        span.positions = mapSSBO(shards[i].posSSbo, particleBytes(), offset, span.count, access);
+        span.velocities = mapSSBO(shards[i].velSSbo, particleBytes(), offset, span.count, access);
+        span.colors = (glm::vec4 *)mapSSBO(shards[i].colSSbo, sizeof(glm::vec4), offset, span.count, access);
+        spans.push_back(span);
     }
-    // initialize blackHoleGravity reference in compute shader
-    startColorRef = glGetUniformLocation(computeShader, "startColor");
-    if (startColorRef < 0)
+    return spans;
+}
+
+void unmapSSBOs(size_t first = 0)
+{
+    for (size_t i = first / shardParticles; i < shardCount(); i++)
     {
-        std::cerr << "couldn't find startColorRef in shader\n";
+        unmapSSBO(shards[i].posSSbo);
+        unmapSSBO(shards[i].velSSbo);
+        unmapSSBO(shards[i].colSSbo);
     }
-    // initialize blackHoleGravity reference in compute shader
-    endColorRef = glGetUniformLocation(computeShader, "endColor");
-    if (endColorRef < 0)
+}
+
+void downloadSSBOsToCPU()
+{
+    // Copy the particles currently on the GPU into the CPU backend
+    // Used when switching to the CPU, so the simulation carries on where it was
+    cpuSim.resize(NUM_PARTICLES);
+    // Make sure any compute shader writes have landed before reading back
+    glMemoryBarrier(GL_BUFFER_UPDATE_BARRIER_BIT);
+    std::vector<ParticleSpan> spans = mapSSBOs(GL_MAP_READ_BIT);
+    if (compactStorage)
     {
-        std::cerr << "couldn't find endColorRef in shader\n";
+        cpuSim.unpackCompact(spans, compactBox);
     }
-    // initialize DT reference in compute shader
-    DTRef = glGetUniformLocation(computeShader, "DT");
-    if (DTRef < 0)
+    else
     {
-        std::cerr << "couldn't find DTRef in shader\n";
+        cpuSim.unpack(spans);
     }
+    unmapSSBOs();
 }
 
-glm::vec3 randomInSphere()
+void stepCPUToSSBOs(const SimParams &params)
 {
-    // Generates a random xyz coordinate inside of a unit sphere at the origin
-    // Spheres work better than cubes in a particle sim
-    // from https://karthikkaranth.me/blog/generating-random-points-in-a-sphere/
-    // "Using normally distributed random numbers"
-    // It ain't computationally cheap, but the code is easy and the results are great.
-    // TODO: include in UsefulFunctions.h
-    float u = randomBetween(0, 1);
-    glm::vec3 point = glm::vec3(randomBetween(-1, 1), randomBetween(-1, 1), randomBetween(-1, 1));
-    point = glm::normalize(point);
-    //             cube root
-    float c = std::cbrt(u);
+    // Step on the CPU and write the results straight into the same SSBOs the render
+    // shader reads. The CPU store is converted back to vec4s as it goes.
+    // Nothing on the GPU writes these while cpuCompute is set, so the GPU copies are
+    // just a mirror of the CPU state and can be thrown away every frame
+    GLbitfield bufMask = GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT;
+    std::vector<ParticleSpan> spans = mapSSBOs(bufMask);
+    if (compactStorage)
+    {
+        cpuSim.stepCompact(params, spans, compactBox);
+    }
+    else
+    {
+        cpuSim.step(params, spans);
+    }
+    unmapSSBOs();
+}
 
-    return point * c;
+void clearColors(size_t first = 0)
+{
+    // White from particle first on, the next simulation step colors them in
+    // Cleared on the GPU, nothing to upload
+    if (colorFromVelocity)
+    {
+        return;
+    }
+    const GLfloat white[4] = {1.0f, 1.0f, 1.0f, 1.0f};
+    for (size_t i = first / shardParticles; i < shardCount(); i++)
+    {
+        size_t from = std::max(first, i * shardParticles) - i * shardParticles;
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, shards[i].colSSbo);
+        glClearBufferSubData(GL_SHADER_STORAGE_BUFFER, GL_RGBA32F, from * sizeof(glm::vec4),
+                             (shardSize(i) - from) * sizeof(glm::vec4), GL_RGBA, GL_FLOAT, white);
+    }
 }
 
-void initSSBOs()
+void seedParticlesOnCPU(size_t first = 0)
 {
-    //I'm only going to comment one of these, because the other SSBOs are essentially the same
-    // Generate the initial buffer
-    glGenBuffers(1, &posSSbo);
-    // Bind to graphics card memory
-    glBindBuffer(GL_SHADER_STORAGE_BUFFER, posSSbo);
-    // Allocate necessary storage 
-    // This might also be able to dump data at the same time. Needs testing though.
-    // If it ain't broke, don't fix it
-    glBufferData(GL_SHADER_STORAGE_BUFFER, NUM_PARTICLES * sizeof(glm::vec4), NULL, GL_STATIC_DRAW);
+    // Positions and velocities of particles first to NUM_PARTICLES come from initialConditions,
+    // generated on every core straight into the mapped buffers. Same seed, same particles,
+    // however many cores
     // Set the bitmask that OpenGL will actually use when copying data to buffer
-    // This particular bitmask tells opengl to write to the buffer, and that previous contents can be thrown away
-    GLint bufMask = GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT;
-
-    // positions and velocities generated randomly in a sphere
+    // This particular bitmask tells opengl to write to the buffer, and that previous contents
+    // of the mapped range can be thrown away. The particles before first are kept
+    GLbitfield bufMask = GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_RANGE_BIT;
     // glMapBufferRange actually lets us stream this data to graphics card memory
-    glm::vec4 *points = (glm::vec4 *)glMapBufferRange(GL_SHADER_STORAGE_BUFFER, 0, NUM_PARTICLES * sizeof(glm::vec4), bufMask);
-    for (int i = 0; i < NUM_PARTICLES; i++)
+    std::vector<ParticleSpan> spans = mapSSBOs(bufMask, first);
+    // At startup they've usually been generated already, then it's just a copy
+    bool pregenerated = first == 0 && pregenerator.take(initialConditions, NUM_PARTICLES);
+    cpuSim.parallelRange(NUM_PARTICLES - first, [&](size_t begin, size_t end) {
+        forEachSpan(spans, first + begin, first + end, [&](const ParticleSpan &span, size_t spanBegin, size_t spanEnd) {
+            for (size_t i = spanBegin; i < spanEnd; i++)
+            {
+                // Particle i is entry j of its shard's mapping
+                size_t j = i - span.first;
+                glm::vec3 position, velocity;
+                if (pregenerated)
+                {
+                    position = pregenerator.getPositions()[i];
+                    velocity = pregenerator.getVelocities()[i];
+                }
+                else
+                {
+                    generateParticle(initialConditions, i, position, velocity);
+                }
+                if (compactStorage)
+                {
+                    encodePosition(position, compactBox, (unsigned int *)span.positions + j * COMPACT_UINTS_PER_PARTICLE);
+                    encodeVelocity(velocity, (unsigned int *)span.velocities + j * COMPACT_UINTS_PER_PARTICLE);
+                }
+                else
+                {
+                    ((glm::vec4 *)span.positions)[j] = glm::vec4(position, 1.0f);
+                    ((glm::vec4 *)span.velocities)[j] = glm::vec4(velocity, 0.0f);
+                }
+            }
+        });
+    });
+    // unmap the buffers (break stream) now that we've uploaded the data
+    unmapSSBOs(first);
+    pregenerator.release();
+}
+
+void seedParticlesOnGPU(size_t first = 0)
+{
+    // Same particles as seedParticlesOnCPU(), generated by seed.glsl right where they
+    // live. Nothing is mapped or uploaded except the settings
+    SeedUniforms uniforms = SeedUniforms();
+    uniforms.compactBox = compactBox;
+    uniforms.radius = initialConditions.radius;
+    uniforms.speed = initialConditions.speed;
+    uniforms.centralAccel = initialConditions.centralAccel;
+    uniforms.separation = initialConditions.separation;
+    uniforms.approachSpeed = initialConditions.approachSpeed;
+    uniforms.seed = initialConditions.seed;
+    uniforms.distribution = initialConditions.distribution;
+    // Startup may still be compiling it
+    finishProgram(&seedShader);
+    glUseProgram(seedShader);
+    // One dispatch per shard, each with its own count and where it starts
+    for (size_t i = first / shardParticles; i < shardCount(); i++)
     {
-        points[i] = glm::vec4(randomInSphere(), 1.0f);
+        size_t shardFirst = i * shardParticles;
+        // Shards are under 2^31 particles, but where they start can be past 2^32
+        uniforms.particleBase = (GLuint)shardFirst;
+        uniforms.particleBaseHigh = (GLuint)((uint64_t)shardFirst >> 32);
+        uniforms.particleCount = shardSize(i);
+        uniforms.firstParticle = std::max(first, shardFirst) - shardFirst;
+        uniformRing.update(seedUniformBlock, &uniforms);
+        bindShard(i);
+        dispatchParticles(uniforms.particleCount - uniforms.firstParticle, WORK_GROUP_SIZE);
     }
-    // unmap the buffer (break stream) now that we've uploaded the data
-    glUnmapBuffer(GL_SHADER_STORAGE_BUFFER);
+}
+
+// Everything the initial particles depend on, what the snapshot is keyed by
+struct SeedKey {
+    InitialConditions initialConditions;
+    size_t particles;
+    int compactStorage;
+    glm::vec4 compactBox;
+};
 
-    // Do it again, twice.
-    glGenBuffers(1, &velSSbo);
-    glBindBuffer(GL_SHADER_STORAGE_BUFFER, velSSbo);
-    glBufferData(GL_SHADER_STORAGE_BUFFER, NUM_PARTICLES * sizeof(glm::vec4), NULL, GL_STATIC_DRAW);
-    glm::vec4 *vels = (glm::vec4 *)glMapBufferRange(GL_SHADER_STORAGE_BUFFER, 0, NUM_PARTICLES * sizeof(glm::vec4), bufMask);
-    for (int i = 0; i < NUM_PARTICLES; i++)
+void seedParticles()
+{
+    // Put the initial particles into the existing SSBOs.
+    // Copied from the snapshot if it has exactly these, otherwise seeded and snapshotted
+    // None of the particles are where the block bounds say any more
+    blockBoundsValid = false;
+    // Value-initialized so the padding compares equal too
+    SeedKey key = SeedKey();
+    key.initialConditions = initialConditions;
+    key.particles = NUM_PARTICLES;
+    key.compactStorage = compactStorage;
+    // The fixed point cube follows the sphere as it is right now
+    compactBox = compactBoxFor(sphere);
+    key.compactBox = compactBox;
+
+    std::vector<GLuint> buffers;
+    std::vector<GLsizeiptr> bytes;
+    for (size_t i = 0; i < shardCount(); i++)
     {
-        vels[i] = 0.1f * glm::vec4(randomInSphere(), 0.0f);
+        buffers.push_back(shards[i].posSSbo);
+        buffers.push_back(shards[i].velSSbo);
+        bytes.push_back(shardSize(i) * particleBytes());
+        bytes.push_back(shardSize(i) * particleBytes());
     }
-    glUnmapBuffer(GL_SHADER_STORAGE_BUFFER);
 
-    glGenBuffers(1, &colSSbo);
-    glBindBuffer(GL_SHADER_STORAGE_BUFFER, colSSbo);
-    glBufferData(GL_SHADER_STORAGE_BUFFER, NUM_PARTICLES * sizeof(glm::vec4), NULL, GL_STATIC_DRAW);
-    glm::vec4 *colors = (glm::vec4 *)glMapBufferRange(GL_SHADER_STORAGE_BUFFER, 0, NUM_PARTICLES * sizeof(glm::vec4), bufMask);
-    for (int i = 0; i < NUM_PARTICLES; i++)
+    // Timed to the end of the work, the GPU versions would otherwise look free
+    std::chrono::steady_clock::time_point seedStart = std::chrono::steady_clock::now();
+    const char *source = "snapshot";
+    if (!keepSnapshot || !snapshot.restore(buffers, bytes, &key, sizeof(key)))
     {
-        // float randNum = randomBetween(0.5, 1);
-        colors[i] = glm::vec4(1.0f, 1.0f, 1.0f, 1.0f);
+        if (gpuSeeding)
+        {
+            seedParticlesOnGPU();
+            source = "GPU";
+        }
+        else
+        {
+            seedParticlesOnCPU();
+            source = "CPU";
+        }
+        if (!keepSnapshot)
+        {
+            snapshot.release();
+        }
+        else if (!snapshot.save(buffers, bytes, &key, sizeof(key)))
+        {
+            printf("Not enough GPU memory for the snapshot, Restart will seed again\n");
+        }
     }
-    glUnmapBuffer(GL_SHADER_STORAGE_BUFFER);
-
-    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 4, posSSbo);
-    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 5, velSSbo);
-    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 6, colSSbo);
+    // Whatever the last run left in the colors
+    clearColors();
+    glFinish();
+    printf("Seeded %zu particles (%s, seed %u) from the %s in %.1f ms\n", NUM_PARTICLES,
+           distributionName(initialConditions.distribution), initialConditions.seed, source,
+           std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - seedStart).count());
 
     // Ensures accesses to the SSBOs "reflect" writes from compute shader
     glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
-}
 
-void toggleCameraInput()
-{   // Function just helps deal with the buggy camera I wrote.
-    // TODO: put inside of camera object
-    if (userCameraInput)
+    // CPU backend needs its own copy of the new particles
+    if (cpuCompute)
     {
-        camera.disableUserInput();
+        downloadSSBOsToCPU();
     }
-    else
+}
+
+void initSSBOs()
+{
+    // Buffers for NUM_PARTICLES, in as many shards as it takes, then the particles themselves
+    chooseShardSize();
+    if (!reserveShards(NUM_PARTICLES, 0))
     {
-        camera.enableUserInput();
+        printf("Not enough GPU memory for %zu particles\n", NUM_PARTICLES);
+        return;
     }
-    userCameraInput = !userCameraInput;
+    seedParticles();
 }
 
-void initShaders(GLFWwindow *window)
+void resizeParticles(size_t count)
 {
-    // This function just packages most of the setup into a single function call
-    initSSBOs();
-
-    // Pass initial view/projection matrices to rendershader
-    glUseProgram(renderShader);
-
-    // Initialize camera object
-    camera.init(
-        window, cameraPosition,
-        glm::perspective(
-            glm::radians<float>(55),
-            (float)windowSizeX / (float)windowSizeY,
-            0.01f,
-            10000.0f),
-        horizontalAngle, verticalAngle,
-        cameraSpeed, mouseSensitivity,
-        true);
-    toggleCameraInput();
-    if (userCameraInput)
+    // Change the particle count without restarting: shrinking drops the particles past
+    // the new count, growing keeps every particle there is and seeds only the new ones.
+    // The new ones are the same particles a restart at the new count would give them
+    if (count < 1 || count == NUM_PARTICLES)
+    {
+        return;
+    }
+    size_t oldCount = NUM_PARTICLES;
+    // Whatever the GPU is still doing to the particles has to land before they're copied
+    glMemoryBarrier(GL_BUFFER_UPDATE_BARRIER_BIT);
+    // Buffers with room to spare grow in place, the rest are copied into bigger ones
+    if (!reserveShards(count, std::min(count, oldCount)))
+    {
+        printf("Not enough GPU memory for %zu particles, keeping %zu\n", count, oldCount);
+        return;
+    }
+    NUM_PARTICLES = count;
+    if (count > oldCount)
     {
-        // Again, necessary because of buggy camera.
-        // TODO: remove when camera works properly.
-        camera.update();
-    }
-    viewMatrix = camera.getViewMatrix();
-    projectionMatrix = camera.getProjectionMatrix();
-    glUniformMatrix4fv(viewMatRef, 1, GL_FALSE, glm::value_ptr(viewMatrix));       // update viewmatrix in shader
-    glUniformMatrix4fv(projMatRef, 1, GL_FALSE, glm::value_ptr(projectionMatrix)); // update projection matrix in shader
-
-    // Give rendershader references to same SSBOs compute shader uses
-    glEnableVertexAttribArray(0);
-    glBindBuffer(GL_ARRAY_BUFFER, posSSbo);
-    glVertexPointer(4, GL_FLOAT, 0, (void *)0);
-    glEnableVertexAttribArray(1);
-    glBindBuffer(GL_ARRAY_BUFFER, velSSbo);
-    glVertexPointer(4, GL_FLOAT, 0, (void *)0);
-    glEnableVertexAttribArray(2);
-    glBindBuffer(GL_ARRAY_BUFFER, colSSbo);
-    glVertexPointer(4, GL_FLOAT, 0, (void *)0);
+        if (gpuSeeding)
+        {
+            seedParticlesOnGPU(oldCount);
+        }
+        else
+        {
+            seedParticlesOnCPU(oldCount);
+        }
+        clearColors(oldCount);
+    }
+    glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+    printf("Resized from %zu to %zu particles\n", oldCount, count);
 
-    glGenVertexArrays(1, &vao);
-    glBindVertexArray(vao);
+    // The CPU backend only has the old particles
+    if (cpuCompute)
+    {
+        downloadSSBOsToCPU();
+    }
 }
 
-void key_callback(GLFWwindow *window, int key, int scancode, int action, int mods)
+void setColorFromVelocity(bool enable)
 {
-    // Function GLFW will use to handle keypresses
-    if (action == GLFW_PRESS)
+    // Switch where particle colors come from. Both the compute variants and the
+    // render shader change, and the Col buffers are freed or brought back
+    if (enable == colorFromVelocity)
+    {
+        return;
+    }
+    colorFromVelocity = enable;
+    createComputeVariants();
+    createRenderShader();
+    // Only the Col buffers change, positions and velocities are kept
+    if (!reserveShards(NUM_PARTICLES, NUM_PARTICLES))
+    {
+        printf("Not enough GPU memory for the color buffers\n");
+    }
+    // White until the next step fills them in, both backends write every color every step
+    clearColors();
+}
+
+void setCompactStorage(bool enable)
+{
+    // Switch the position/velocity buffer layout. Both shaders change with it,
+    // and the simulation restarts, the old buffers are in the other layout
+    if (enable == compactStorage)
+    {
+        return;
+    }
+    compactStorage = enable;
+    createComputeVariants();
+    createRenderShader();
+    initSSBOs();
+}
+
+void setFrustumCulling(bool enable)
+{
+    // Switch between drawing every particle and drawing what cull.glsl finds on screen.
+    // The render shader changes, the compute variants keep block bounds or stop,
+    // and the culling buffers are made or freed
+    if (enable == frustumCulling)
+    {
+        return;
+    }
+    frustumCulling = enable;
+    createComputeVariants();
+    createRenderShader();
+    if (!reserveShards(NUM_PARTICLES, NUM_PARTICLES))
+    {
+        printf("Not enough GPU memory for the culling buffers\n");
+    }
+}
+
+void toggleCameraInput()
+{   // Function just helps deal with the buggy camera I wrote.
+    // TODO: put inside of camera object
+    if (userCameraInput)
+    {
+        camera.disableUserInput();
+    }
+    else
+    {
+        camera.enableUserInput();
+    }
+    userCameraInput = !userCameraInput;
+}
+
+void initShaders(GLFWwindow *window)
+{
+    // This function just packages most of the setup into a single function call
+    initSSBOs();
+
+    // Pass initial view/projection matrices to rendershader
+    glUseProgram(renderShader);
+
+    if (headless)
+    {
+        // No window means no camera input either, just look down +z from the
+        // starting position like the camera does before it's moved
+        userCameraInput = false;
+        viewMatrix = glm::lookAt(cameraPosition, cameraPosition + glm::vec3(0.0f, 0.0f, 1.0f), glm::vec3(0.0f, 1.0f, 0.0f));
+        projectionMatrix = glm::perspective(
+            glm::radians<float>(55),
+            (float)headlessWidth / (float)headlessHeight,
+            0.01f,
+            10000.0f);
+    }
+    else
+    {
+        // Initialize camera object
+        camera.init(
+            window, cameraPosition,
+            glm::perspective(
+                glm::radians<float>(55),
+                (float)windowSizeX / (float)windowSizeY,
+                0.01f,
+                10000.0f),
+            horizontalAngle, verticalAngle,
+            cameraSpeed, mouseSensitivity,
+            true);
+        toggleCameraInput();
+        if (userCameraInput)
+        {
+            // Again, necessary because of buggy camera.
+            // TODO: remove when camera works properly.
+            camera.update();
+        }
+        viewMatrix = camera.getViewMatrix();
+        projectionMatrix = camera.getProjectionMatrix();
+    }
+
+    // Rendershader reads the same SSBOs compute shader uses, no vertex attributes at all.
+    // drawParticles() binds them one shard at a time
+    glGenVertexArrays(1, &vao);
+    glBindVertexArray(vao);
+}
+
+void key_callback(GLFWwindow *window, int key, int scancode, int action, int mods)
+{
+    // Function GLFW will use to handle keypresses
+    if (action == GLFW_PRESS)
     {
         switch (key)
         {
@@ -612,54 +1434,110 @@ void initIMGUI(GLFWwindow *window)
     ImGui_ImplGlfw_InitForOpenGL(window, true);
     ImGui_ImplOpenGL3_Init("#version 130");
     io.ConfigFlags |= ImGuiConfigFlags_NoMouseCursorChange;
+    // Rasterize the font atlas now, while the driver is busy compiling, rather than in
+    // the first frame. The backend uploads it on its first NewFrame()
+    io.Fonts->Build();
+}
+
+double currentTime()
+{
+    // Headless runs use a fixed timestep, so their clock is just frames * timestep
+    return headless ? headlessClock : glfwGetTime();
+}
+
+void currentColors(glm::vec3 &startColor, glm::vec3 &endColor)
+{
+    // Low- and high-speed colors right now, they drift between the two pairs over time
+    double clockTime = currentTime();
+    startColor = startColorA * (float)std::abs(1.570796 + std::sin(clockTime * colorSpeed)) + startColorB * (float)std::abs(std::sin(clockTime * colorSpeed));
+    endColor = endColorA * (float)std::abs(1.570796 + std::sin(clockTime * colorSpeed)) + endColorB * (float)std::abs(std::sin(clockTime * colorSpeed));
 }
 
-void updateComputeShader(float deltaTime)
+SimParams computeSimParams(float deltaTime)
 {
-    //Update all of the uniform control variables in the compute shader
+    // Work out all of the simulation control variables for this frame
+    // Both the compute shader and the CPU backend get their values from here
     // Keep a static simulation time separate from glfwGetTime to play/pause/rewind simulation
     static float simTime = 0.0f;
-    double clockTime = glfwGetTime();
+    SimParams params;
 
     simTime += deltaTime * simulationSpeed;
-    glUniform1f(DTRef, deltaTime * simulationSpeed);
-    glUniform1i(sphereEnableRef, boundingSphereEnable);
+    params.DT = deltaTime * simulationSpeed;
+    params.sphereEnable = boundingSphereEnable;
+
+    params.blackHole1 = glm::vec3(
+        blackHoleXZDisp * std::sin(simTime * blackHoleSpeed) + blackHoleXcoord,
+        blackHoleYDisp + blackHoleYcoord,
+        blackHoleXZDisp * std::cos(simTime * blackHoleSpeed) + blackHoleZcoord);
+    params.blackHole2 = glm::vec3(
+        blackHoleXZDisp * std::sin(3.1415 + simTime * blackHoleSpeed) + blackHoleXcoord,
+        -blackHoleYDisp + blackHoleYcoord,
+        blackHoleXZDisp * std::cos(3.1415 + simTime * blackHoleSpeed) + blackHoleZcoord);
+    params.sphere = sphere;
+    params.blackHoleAccel = blackHoleGravity;
+
+    params.floorPos = floorPos;
+    params.floorEnable = floorEnable;
+
+    currentColors(params.startColor, params.endColor);
+    params.colorScale = colorScale;
+
+    return params;
+}
+
+void updateComputeShader(const SimParams &params, GLuint particleCount)
+{
+    // Pack all of the control variables into the compute shader's uniform block
+    // sphereEnable and floorEnable are baked into the program, see createComputeVariants()
+    // Value-initialized so the padding is zero and compares equal in the ring's dirty check
+    SimUniforms uniforms = SimUniforms();
+    uniforms.DT = params.DT;
+
+    uniforms.blackHole1 = params.blackHole1;
+    uniforms.blackHole2 = params.blackHole2;
+    uniforms.sphere = params.sphere;
+    uniforms.blackHoleAccel = params.blackHoleAccel;
 
-    glUniform3f(BH1Ref,
-                blackHoleXZDisp * std::sin(simTime * blackHoleSpeed) + blackHoleXcoord,
-                blackHoleYDisp + blackHoleYcoord,
-                blackHoleXZDisp * std::cos(simTime * blackHoleSpeed) + blackHoleZcoord);
-    glUniform3f(BH2Ref,
-                blackHoleXZDisp * std::sin(3.1415 + simTime * blackHoleSpeed) + blackHoleXcoord,
-                -blackHoleYDisp + blackHoleYcoord,
-                blackHoleXZDisp * std::cos(3.1415 + simTime * blackHoleSpeed) + blackHoleZcoord);
-    glUniform4fv(sphereRef, 1, glm::value_ptr(sphere));
-    glUniform1f(BHGravityRef, blackHoleGravity);
+    uniforms.floorPos = params.floorPos;
+    uniforms.compactBox = compactBox;
 
-    glUniform1f(floorPosRef, floorPos);
-    glUniform1i(floorEnableRef, floorEnable);
+    uniforms.startColor = params.startColor;
+    uniforms.endColor = params.endColor;
+    uniforms.colorScale = params.colorScale;
 
-    glm::vec3 startColor = startColorA * (float)std::abs(1.570796 + std::sin(clockTime * colorSpeed)) + startColorB * (float)std::abs(std::sin(clockTime * colorSpeed));
-    glm::vec3 endColor = endColorA * (float)std::abs(1.570796 + std::sin(clockTime * colorSpeed)) + endColorB * (float)std::abs(std::sin(clockTime * colorSpeed));
+    // compute.glsl skips the invocations past the end of the last work group
+    uniforms.particleCount = particleCount;
 
-    glUniform3f(startColorRef, startColor.r, startColor.g, startColor.b);
-    glUniform3f(endColorRef, endColor.r, endColor.g, endColor.b);
-    glUniform1f(colorScaleRef, colorScale);
+    // Only actually uploaded if something changed since the last step
+    uniformRing.update(simUniformBlock, &uniforms);
 }
 
 void updateRenderShader()
 {
     // Update all uniform variables to control rendershader
     // Really just VP matrices and particle size variables, to keep most computation in... compute shader
-    if (userCameraInput)
+    // Headless runs keep the matrices initShaders() made
+    if (!headless)
     {
-        camera.update();
+        if (userCameraInput)
+        {
+            camera.update();
+        }
+        viewMatrix = camera.getViewMatrix();
+        projectionMatrix = camera.getProjectionMatrix();
     }
-    viewMatrix = camera.getViewMatrix();
-    projectionMatrix = camera.getProjectionMatrix();
-    glUniformMatrix4fv(viewMatRef, 1, GL_FALSE, glm::value_ptr(viewMatrix));       // update viewmatrix in shader
-    glUniformMatrix4fv(projMatRef, 1, GL_FALSE, glm::value_ptr(projectionMatrix)); // update projection matrix in shader
-    glUniform1f(particleSizeRef, particleSize);
+    RenderUniforms uniforms = RenderUniforms();
+    uniforms.viewMat = viewMatrix;
+    uniforms.projMat = projectionMatrix;
+    uniforms.compactBox = compactBox;
+    uniforms.particleSizeScalar = particleSize;
+    uniforms.colorScale = colorScale;
+    // cull.glsl needs it to work out how far points reach past their centers
+    GLint viewport[4];
+    glGetIntegerv(GL_VIEWPORT, viewport);
+    uniforms.viewportSize = glm::vec2(viewport[2], viewport[3]);
+    // Nothing is uploaded while the camera sits still
+    uniformRing.update(renderUniformBlock, &uniforms);
 }
 
 void renderImGui(GLFWwindow *window){      
@@ -670,17 +1548,84 @@ void renderImGui(GLFWwindow *window){
     ImGui::NewFrame();
     {
         ImGui::Begin("Settings"); 
-        ImGui::InputInt("Number of particles", &numParticlesTemp);
+        // Same step buttons as InputInt
+        const unsigned long long particleStep = 1, particleStepFast = 100;
+        ImGui::InputScalar("Number of particles", ImGuiDataType_U64, &numParticlesTemp, &particleStep, &particleStepFast);
+        // Keeps the running simulation, Restart starts over at the new count
         if(ImGui::Button("Set particle count")){
-            NUM_PARTICLES = numParticlesTemp;
-            initSSBOs();
-        }
-        // NOTE: This is not really adjustable at runtime
-        // The only way to actually do this is to recompile the
-        // compute shader with the new local workgroup size.
-        // Which is code that I don't feel like writing right now.
-        // ImGui::DragInt("Workgroup size\nNOTE: cannot really do anything", &WORK_GROUP_SIZE);
+            resizeParticles((size_t)std::max(numParticlesTemp, 1ULL));
+        }
+        // The local work group size is compiled into the compute shader,
+        // so picking a new one rebuilds all of the variants
+        if (ImGui::BeginCombo("Workgroup size", std::to_string(WORK_GROUP_SIZE).c_str()))
+        {
+            std::vector<int> sizes = workGroupTuner.candidates();
+            for (size_t i = 0; i < sizes.size(); i++)
+            {
+                if (ImGui::Selectable(std::to_string(sizes[i]).c_str(), sizes[i] == WORK_GROUP_SIZE))
+                {
+                    WORK_GROUP_SIZE = sizes[i];
+                    createComputeVariants();
+                }
+            }
+            ImGui::EndCombo();
+        }
+        ImGui::SameLine();
+        if (ImGui::Button("Retune"))
+        {
+            tuneWorkGroupSize();
+        }
+        if (!workGroupTuner.getTimes().empty() && ImGui::TreeNode("Tuning results"))
+        {
+            const std::vector<std::pair<int, double> > &times = workGroupTuner.getTimes();
+            for (size_t i = 0; i < times.size(); i++)
+            {
+                ImGui::Text("%4d: %.3f ms", times[i].first, times[i].second);
+            }
+            ImGui::TreePop();
+        }
         ImGui::SliderFloat("Timestep", &simulationSpeed, -5000.0f, 5000.0f);
+        ImGui::Checkbox("Simulate on CPU", &cpuCheckBoxFlag);
+        ImGui::SameLine();
+        ImGui::Text("(%d threads)", cpuSim.getNumThreads());
+        if (cpuCompute)
+        {
+            // Widest supported instruction set is picked at startup, but
+            // it's handy to be able to compare against the narrower ones
+            int isa = cpuSim.getKernelISA();
+            if (ImGui::BeginCombo("CPU kernel", kernelISAName((KernelISA)isa)))
+            {
+                for (int i = 0; i < ISA_COUNT; i++)
+                {
+                    if (kernelISASupported((KernelISA)i) && ImGui::Selectable(kernelISAName((KernelISA)i), i == isa))
+                    {
+                        cpuSim.setKernelISA((KernelISA)i);
+                    }
+                }
+                ImGui::EndCombo();
+            }
+        }
+        if (ImGui::CollapsingHeader("CPU Backend Settings"))
+        {
+            // Threads and memory only change on Apply, it restarts the whole backend
+            ImGui::Indent();
+            const char *hugePageNames[] = {"Off", "Transparent", "Explicit (hugetlbfs)"};
+            ImGui::InputInt("Threads (0 = all cores)", &cpuConfig.numThreads);
+            ImGui::Checkbox("Pin threads to cores", &cpuConfig.pinThreads);
+            ImGui::Combo("Huge pages", (int *)&cpuConfig.hugePages, hugePageNames, 3);
+            if (ImGui::Button("Apply"))
+            {
+                cpuSim.init(cpuConfig);
+                if (cpuCompute)
+                {
+                    downloadSSBOsToCPU();
+                }
+            }
+            ImGui::Text("Running: %d threads, %s, huge pages %s", cpuSim.getNumThreads(),
+                        cpuSim.getPinThreads() ? "pinned" : "unpinned",
+                        hugePageNames[cpuSim.getStore().getHugePages()]);
+            ImGui::Unindent();
+        }
         if (ImGui::Button("Start"))
         {
             runSim = true;
@@ -698,7 +1643,8 @@ void renderImGui(GLFWwindow *window){
         ImGui::SameLine();
         if (ImGui::Button("Restart"))
         {
-            initSSBOs();
+            // Same buffers, just the initial particles again
+            seedParticles();
         }
         ImGui::SameLine();
         if (ImGui::Button("Reset Camera"))
@@ -728,6 +1674,88 @@ void renderImGui(GLFWwindow *window){
             ImGui::SliderFloat("Color scale", &colorScale, 0.0f, 15.0f);
             ImGui::SliderFloat("Color speed", &colorSpeed, 0.0f, 5.0f); 
             ImGui::SliderFloat("Particle size", &particleSize, 0.0f, 10000.0f);
+            // Saves the Col buffer and all of its writes, at the cost of a texture
+            // fetch per vertex. The table is half floats, colors past 1 come out the same
+            bool colorFlag = colorFromVelocity;
+            if (ImGui::Checkbox("Color from velocity (no color buffer)", &colorFlag))
+            {
+                setColorFromVelocity(colorFlag);
+            }
+            // Restarts the simulation
+            bool compactFlag = compactStorage;
+            if (ImGui::Checkbox("Compact storage (16-bit positions, half velocities)", &compactFlag))
+            {
+                setCompactStorage(compactFlag);
+            }
+            // Compute pass that drops off-screen particles, drawn through an indirect command
+            bool cullFlag = frustumCulling;
+            if (ImGui::Checkbox("Frustum culling", &cullFlag))
+            {
+                setFrustumCulling(cullFlag);
+            }
+            // Radix sorts the buffers by position now and then, see keepParticlesSorted()
+            ImGui::Checkbox("Morton order sorting", &spatialSorting);
+            if (spatialSorting)
+            {
+                ImGui::SliderFloat("Sort threshold", &sortThreshold, 0.05f, 1.0f);
+                ImGui::InputInt("Sort every N steps (0: by threshold only)", &sortInterval);
+                sortInterval = std::max(sortInterval, 0);
+                ImGui::Text("%d sorts, last %.3f ms GPU, disorder %.2f (%.2f sorted)", sortCount, lastSortMs, lastDisorder,
+                            sortedDisorder);
+            }
+            GLsizeiptr bytesPerParticle = 2 * particleBytes() + (colorFromVelocity ? 0 : sizeof(glm::vec4));
+            ImGui::Text("Particle storage: %d B/particle, %.1f MB in %zu shard(s)", (int)bytesPerParticle,
+                        bytesPerParticle * (double)NUM_PARTICLES / (1024.0 * 1024.0), shardCount());
+            // What's really allocated, including the pool's spare room and the snapshot
+            ImGui::Text("GPU particle buffers: %.1f MB (peak %.1f MB)", bufferPool.getCurrentBytes() / (1024.0 * 1024.0),
+                        bufferPool.getPeakBytes() / (1024.0 * 1024.0));
+        }
+        if (ImGui::CollapsingHeader("Initial Conditions"))
+        {
+            // Only used when the particles are (re)made: Restart or Set particle count
+            ImGui::Indent();
+            int distribution = initialConditions.distribution;
+            if (ImGui::BeginCombo("Distribution", distributionName(initialConditions.distribution)))
+            {
+                for (int i = 0; i < DIST_COUNT; i++)
+                {
+                    if (ImGui::Selectable(distributionName((Distribution)i), i == distribution))
+                    {
+                        // Every distribution wants different sizes, start from its defaults
+                        uint32_t seed = initialConditions.seed;
+                        initialConditions = defaultInitialConditions((Distribution)i);
+                        initialConditions.seed = seed;
+                    }
+                }
+                ImGui::EndCombo();
+            }
+            ImGui::Checkbox("Generate on the GPU", &gpuSeeding);
+            if (ImGui::Checkbox("Keep a snapshot for Restart", &keepSnapshot) && !keepSnapshot)
+            {
+                snapshot.release();
+            }
+            if (keepSnapshot)
+            {
+                ImGui::SameLine();
+                ImGui::Text("(%.1f MB)", snapshot.getSize() / (1024.0 * 1024.0));
+            }
+            int seed = (int)initialConditions.seed;
+            if (ImGui::InputInt("Seed", &seed))
+            {
+                initialConditions.seed = (uint32_t)seed;
+            }
+            ImGui::SliderFloat("Radius / scale length", &initialConditions.radius, 1.0f, 1000.0f);
+            ImGui::SliderFloat("Random speed", &initialConditions.speed, 0.0f, 2.0f);
+            if (initialConditions.distribution >= DIST_DISK)
+            {
+                ImGui::SliderFloat("Central G*M", &initialConditions.centralAccel, 0.0f, 500.0f);
+            }
+            if (initialConditions.distribution == DIST_TWO_GALAXIES)
+            {
+                ImGui::SliderFloat("Separation", &initialConditions.separation, 0.0f, 2000.0f);
+                ImGui::SliderFloat("Approach speed", &initialConditions.approachSpeed, 0.0f, 5.0f);
+            }
+            ImGui::Unindent();
         }
         if (ImGui::CollapsingHeader("Physics Settings"))
         {
@@ -777,6 +1805,36 @@ void renderImGui(GLFWwindow *window){
                 ImGui::Unindent();
             }
         }
+        if (ImGui::CollapsingHeader("GPU Timings"))
+        {
+            // Read back a few frames late, see GPUTimer.h
+            // Whole frame minus the passes is everything else: clears, MSAA resolve, swap
+            ImGui::Indent();
+            for (int pass = 0; pass <= NUM_PASSES; pass++)
+            {
+                char overlay[64];
+                snprintf(overlay, sizeof(overlay), "%.3f ms (avg %.3f)", gpuTimer.latest(pass), gpuTimer.average(pass));
+                ImGui::PlotLines(gpuPassNames[pass], gpuTimer.getHistory(pass), GPU_TIMER_HISTORY,
+                                 gpuTimer.historyOffset(), overlay, 0.0f, FLT_MAX, ImVec2(0, 40));
+            }
+            ImGui::Text("Uniform block uploads: %lu (%s)", uniformRing.getUploads(),
+                        uniformRing.isPersistent() ? "persistently mapped" : "glBufferSubData");
+            ImGui::Text("Shader programs: %d from cache, %d compiled", programCache.getHits(), programCache.getMisses());
+            if (ImGui::TreeNode("Startup"))
+            {
+                const std::vector<StartupTimer::Phase> &phases = startupTimer.getPhases();
+                for (size_t i = 0; i < phases.size(); i++)
+                {
+                    ImGui::Text("%-16s %8.1f ms (at %.1f ms)", phases[i].name.c_str(), phases[i].ms, phases[i].sinceLaunch);
+                }
+                ImGui::TreePop();
+            }
+            if (gpuTimer.getDroppedSamples() > 0)
+            {
+                ImGui::Text("%d samples dropped, GPU was more than %d frames behind", gpuTimer.getDroppedSamples(), GPU_TIMER_LATENCY);
+            }
+            ImGui::Unindent();
+        }
         ImGui::Text("Application average %.3f ms/frame (%.1f FPS)", 1000.0f / ImGui::GetIO().Framerate, ImGui::GetIO().Framerate);
         ImGui::End();
     }
@@ -798,19 +1856,884 @@ void renderImGui(GLFWwindow *window){
     {
         floorEnable = 0;
     }
+    // Swap to the compute shader variant matching the checkboxes
+    computeShader = computeVariants[computeVariantIndex(boundingSphereEnable, floorEnable)];
+    if (cpuCheckBoxFlag != cpuCompute)
+    {
+        // Switching to the CPU needs the current particles from the GPU first.
+        // Switching back needs nothing, the SSBOs are updated every CPU step
+        if (cpuCheckBoxFlag)
+        {
+            downloadSSBOsToCPU();
+        }
+        cpuCompute = cpuCheckBoxFlag;
+    }
 
     // Render ImGui windows
     ImGui::Render();
+    gpuTimer.begin(PASS_UI);
     ImGui_ImplOpenGL3_RenderDrawData(ImGui::GetDrawData());
+    gpuTimer.end(PASS_UI);
+}
+
+void stepSimulation(double deltaTime)
+{
+    // One simulation step on whichever backend is active
+    SimParams params = computeSimParams(deltaTime);
+    if (cpuCompute)
+    {
+        // Step on every core, then hand the result to the render shader
+        stepCPUToSSBOs(params);
+        // Only compute.glsl keeps the block bounds
+        blockBoundsValid = false;
+    }
+    else
+    {
+        // Swap to compute shader
+        glUseProgram(computeShader);
+        gpuTimer.begin(PASS_SIMULATE);
+        // One dispatch per shard, the uniform ring keeps each one's count apart
+        for (size_t shard = 0; shard < shardCount(); shard++)
+        {
+            bindShard(shard);
+            // The variants grow the block bounds from empty, see bounds.glsl
+            if (shards[shard].boundsSSbo != 0)
+            {
+                glBindBuffer(GL_COPY_WRITE_BUFFER, shards[shard].boundsSSbo);
+                glClearBufferData(GL_COPY_WRITE_BUFFER, GL_R32UI, GL_RED_INTEGER, GL_UNSIGNED_INT, NULL);
+            }
+            // update uniforms
+            updateComputeShader(params, shardSize(shard));
+            // actually run the compute shader
+            // rounded up and tiled past 65535 groups, the shader bounds-checks the rest
+            dispatchParticles(shardSize(shard), WORK_GROUP_SIZE);
+        }
+        blockBoundsValid = frustumCulling;
+        gpuTimer.end(PASS_SIMULATE);
+    }
+}
+
+void measureExtent()
+{
+    // Box around every shard's particles for sort.glsl's keys, left bound for the passes
+    // after. Starts the disorder sum over too
+    finishProgram(&sortShaders[SORT_BOUNDS]);
+    GLuint state = bufferPool.reserve(sortStateSlot, SORT_STATE_UINTS * sizeof(GLuint));
+    glBindBuffer(GL_COPY_WRITE_BUFFER, state);
+    glClearBufferData(GL_COPY_WRITE_BUFFER, GL_R32UI, GL_RED_INTEGER, GL_UNSIGNED_INT, NULL);
+    // The positions from the last step
+    glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+    glUseProgram(sortShaders[SORT_BOUNDS]);
+    glBindBufferRange(GL_SHADER_STORAGE_BUFFER, 17, state, 0, SORT_STATE_UINTS * sizeof(GLuint));
+    for (size_t shard = 0; shard < shardCount(); shard++)
+    {
+        SortUniforms uniforms = SortUniforms();
+        uniforms.compactBox = compactBox;
+        uniforms.particleCount = (GLuint)shardSize(shard);
+        uniformRing.update(sortUniformBlock, &uniforms);
+        bindShard(shard);
+        dispatchParticles(uniforms.particleCount, SORT_GROUP_PARTICLES);
+    }
+    glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+}
+
+bool sortParticles()
+{
+    // Put every shard's particles in Morton order, see sort.glsl. Keys and indices are
+    // radix sorted on the GPU, then the positions, velocities and colors are gathered into
+    // the new order through the scratch buffer and copied back. Nothing comes back to the CPU.
+    // Returns false if the sort buffers couldn't be had, shards from there on are left as they were
+    for (int pass = 0; pass < NUM_SORT_PASSES; pass++)
+    {
+        finishProgram(&sortShaders[pass]);
+    }
+    finishProgram(&sortColorShader);
+    gpuTimer.begin(PASS_SORT);
+    measureExtent();
+    bool fits = true;
+    for (size_t shard = 0; shard < shardCount() && fits; shard++)
+    {
+        size_t particles = shardSize(shard);
+        SortUniforms uniforms = SortUniforms();
+        uniforms.compactBox = compactBox;
+        uniforms.particleCount = (GLuint)particles;
+        uniforms.groupCount = (GLuint)((particles + SORT_GROUP_PARTICLES - 1) / SORT_GROUP_PARTICLES);
+        GLsizeiptr pairBytes = particles * sizeof(GLuint);
+        GLsizeiptr countBytes = uniforms.groupCount * SORT_RADIX * sizeof(GLuint);
+        // Room for the biggest attribute, colors or full size positions
+        GLsizeiptr scratchBytes = particles * sizeof(glm::vec4);
+        GLuint indices[2], keys[2];
+        for (int i = 0; i < 2; i++)
+        {
+            indices[i] = bufferPool.reserve(sortIndexSlots[i], pairBytes);
+            keys[i] = bufferPool.reserve(sortKeySlots[i], pairBytes);
+            fits = fits && bufferPool.getCapacity(sortIndexSlots[i]) >= pairBytes &&
+                   bufferPool.getCapacity(sortKeySlots[i]) >= pairBytes;
+        }
+        GLuint counts = bufferPool.reserve(sortCountSlot, countBytes);
+        GLuint scratch = bufferPool.reserve(sortScratchSlot, scratchBytes);
+        fits = fits && bufferPool.getCapacity(sortCountSlot) >= countBytes && bufferPool.getCapacity(sortScratchSlot) >= scratchBytes;
+        if (!fits)
+        {
+            break;
+        }
+        bindShard(shard);
+        // Every particle's key, and the order they're in now
+        uniformRing.update(sortUniformBlock, &uniforms);
+        glBindBufferRange(GL_SHADER_STORAGE_BUFFER, 12, indices[0], 0, pairBytes);
+        glBindBufferRange(GL_SHADER_STORAGE_BUFFER, 13, keys[0], 0, pairBytes);
+        glUseProgram(sortShaders[SORT_KEYS]);
+        dispatchParticles(particles, SORT_GROUP_SIZE);
+        glBindBufferRange(GL_SHADER_STORAGE_BUFFER, 16, counts, 0, countBytes);
+        // 4 bits a round from the lowest, each round reads one set of pairs and writes the other
+        for (int round = 0; round < 8; round++)
+        {
+            int from = round % 2;
+            uniforms.shift = round * 4;
+            uniformRing.update(sortUniformBlock, &uniforms);
+            glBindBufferRange(GL_SHADER_STORAGE_BUFFER, 12, indices[from], 0, pairBytes);
+            glBindBufferRange(GL_SHADER_STORAGE_BUFFER, 13, keys[from], 0, pairBytes);
+            glBindBufferRange(GL_SHADER_STORAGE_BUFFER, 14, indices[1 - from], 0, pairBytes);
+            glBindBufferRange(GL_SHADER_STORAGE_BUFFER, 15, keys[1 - from], 0, pairBytes);
+            for (int pass = SORT_COUNT; pass <= SORT_SCATTER; pass++)
+            {
+                glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+                glUseProgram(sortShaders[pass]);
+                if (pass == SORT_SCAN)
+                {
+                    // One work group walks all the counts
+                    glDispatchCompute(1, 1, 1);
+                }
+                else
+                {
+                    dispatchParticles(particles, SORT_GROUP_PARTICLES);
+                }
+            }
+        }
+        // After an even number of rounds the sorted order is back in the first set
+        glBindBufferRange(GL_SHADER_STORAGE_BUFFER, 12, indices[0], 0, pairBytes);
+        GLuint attributes[3] = {shards[shard].posSSbo, shards[shard].velSSbo, shards[shard].colSSbo};
+        GLsizeiptr attributeBytes[3] = {particleBytes(), particleBytes(), sizeof(glm::vec4)};
+        for (int a = 0; a < 3; a++)
+        {
+            // No Col buffer in colorFromVelocity mode
+            if (attributes[a] == 0)
+            {
+                continue;
+            }
+            glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+            glUseProgram(a == 2 ? sortColorShader : sortShaders[SORT_GATHER]);
+            glBindBufferRange(GL_SHADER_STORAGE_BUFFER, 14, attributes[a], 0, particles * attributeBytes[a]);
+            glBindBufferRange(GL_SHADER_STORAGE_BUFFER, 15, scratch, 0, particles * attributeBytes[a]);
+            dispatchParticles(particles, SORT_GROUP_SIZE);
+            glMemoryBarrier(GL_BUFFER_UPDATE_BARRIER_BIT);
+            glBindBuffer(GL_COPY_READ_BUFFER, scratch);
+            glBindBuffer(GL_COPY_WRITE_BUFFER, attributes[a]);
+            glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, 0, particles * attributeBytes[a]);
+        }
+    }
+    gpuTimer.end(PASS_SORT);
+    // Hundreds of MB for big shards, only worth keeping for the next sort
+    for (int i = 0; i < 2; i++)
+    {
+        bufferPool.release(sortIndexSlots[i]);
+        bufferPool.release(sortKeySlots[i]);
+    }
+    bufferPool.release(sortCountSlot);
+    bufferPool.release(sortScratchSlot);
+    // Shards sorted before one that didn't fit are fine as they are, they're the same particles.
+    // Either way the block bounds are of the old order, the next step makes them again
+    blockBoundsValid = false;
+    return fits;
+}
+
+void measureDisorder()
+{
+    // Start adding up how far apart particles 8i and 8i+1 of every shard are in the
+    // octree (sort.glsl's SORT_DISORDER), read back by keepParticlesSorted() once
+    // disorderFence says it's done, so nothing waits for it. Levels are of the box around
+    // the particles as they are now, same as a sort would use
+    finishProgram(&sortShaders[SORT_DISORDER]);
+    measureExtent();
+    glUseProgram(sortShaders[SORT_DISORDER]);
+    disorderPairs = 0;
+    for (size_t shard = 0; shard < shardCount(); shard++)
+    {
+        SortUniforms uniforms = SortUniforms();
+        uniforms.compactBox = compactBox;
+        uniforms.particleCount = (GLuint)shardSize(shard);
+        uniformRing.update(sortUniformBlock, &uniforms);
+        bindShard(shard);
+        // One invocation per pair, the last one may be missing its second particle
+        dispatchParticles((uniforms.particleCount + 7) / 8, SORT_GROUP_SIZE);
+        disorderPairs += (uniforms.particleCount + 6) / 8;
+    }
+    // The sum is written by atomics and read back with glGetBufferSubData(), the fence
+    // alone doesn't make it visible to that
+    glMemoryBarrier(GL_BUFFER_UPDATE_BARRIER_BIT);
+    disorderFence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    // Nothing else may flush it when running headless
+    glFlush();
+}
+
+void keepParticlesSorted()
+{
+    // Called after every step. Sorts the particles into Morton order again every
+    // sortInterval steps if that's set, and whenever they've gone more than sortThreshold
+    // of the way from how sorted they were right after the last sort back to random order.
+    // Disorder is the average octree level of measureDisorder()'s pairs over the 10 levels,
+    // about 1 for random order and lower the more sorted. It's measured every
+    // SORT_CHECK_INTERVAL steps and right after every sort, and read back when it's ready
+    // The CPU backend rewrites the buffers from its own copy every step, there's no point
+    if (!spatialSorting || cpuCompute)
+    {
+        return;
+    }
+    // Sorts are rare, the graph's history may well not have one any more
+    if (gpuTimer.latest(PASS_SORT) > 0.0f)
+    {
+        lastSortMs = gpuTimer.latest(PASS_SORT);
+    }
+    sortSteps++;
+    checkSteps++;
+    bool sort = sortInterval > 0 && sortSteps >= sortInterval;
+    if (disorderFence != 0 && glClientWaitSync(disorderFence, 0, 0) != GL_TIMEOUT_EXPIRED)
+    {
+        glDeleteSync(disorderFence);
+        disorderFence = 0;
+        GLuint sum = 0;
+        // After the box, see sort.glsl's SortState
+        glBindBuffer(GL_COPY_READ_BUFFER, bufferPool.getBuffer(sortStateSlot));
+        glGetBufferSubData(GL_COPY_READ_BUFFER, 6 * sizeof(GLuint), sizeof(sum), &sum);
+        lastDisorder = disorderPairs > 0 ? sum / (10.0f * disorderPairs) : 0.0f;
+        if (disorderOfSorted)
+        {
+            sortedDisorder = lastDisorder;
+        }
+        else if (lastDisorder - sortedDisorder > sortThreshold * (1.0f - sortedDisorder))
+        {
+            sort = true;
+        }
+    }
+    if (sort)
+    {
+        if (!sortParticles())
+        {
+            printf("Not enough GPU memory to sort the particles, turning sorting off\n");
+            spatialSorting = false;
+            return;
+        }
+        sortCount++;
+        sortSteps = 0;
+        // Measure what sorted looks like for these particles, a stale measurement is no use now
+        if (disorderFence != 0)
+        {
+            glDeleteSync(disorderFence);
+            disorderFence = 0;
+        }
+        checkSteps = SORT_CHECK_INTERVAL;
+    }
+    if (disorderFence == 0 && checkSteps >= SORT_CHECK_INTERVAL)
+    {
+        measureDisorder();
+        disorderOfSorted = sort;
+        checkSteps = 0;
+    }
+}
+
+void cullParticles()
+{
+    // Find the particles that can be on screen, see cull.glsl. Per shard that's their
+    // indices in VisibleIndices and their count in the shard's indirect draw command,
+    // so nothing comes back to the CPU. Uses the RenderUniforms drawParticles() set.
+    // Each pass runs over every shard before the barrier the next pass needs
+    for (int pass = 0; pass < 3; pass++)
+    {
+        finishProgram(&cullShaders[pass]);
+        glUseProgram(cullShaders[pass]);
+        for (size_t shard = 0; shard < shardCount(); shard++)
+        {
+            CullUniforms uniforms = CullUniforms();
+            uniforms.particleCount = (GLuint)shardSize(shard);
+            uniforms.groupCount = (GLuint)((shardSize(shard) + CULL_GROUP_PARTICLES - 1) / CULL_GROUP_PARTICLES);
+            uniforms.useBlockBounds = blockBoundsValid;
+            uniformRing.update(cullUniformBlock, &uniforms);
+            bindShard(shard);
+            glBindBufferRange(GL_SHADER_STORAGE_BUFFER, 7, shards[shard].visibleSSbo, 0, shardSize(shard) * sizeof(GLuint));
+            glBindBufferRange(GL_SHADER_STORAGE_BUFFER, 8, shards[shard].groupSSbo, 0, uniforms.groupCount * sizeof(GLuint));
+            glBindBufferRange(GL_SHADER_STORAGE_BUFFER, 9, shards[shard].commandBuffer, 0, 8 * sizeof(GLuint));
+            glBindBufferRange(GL_SHADER_STORAGE_BUFFER, 10, shards[shard].maskSSbo, 0,
+                              uniforms.groupCount * CULL_GROUP_SIZE * 2 * sizeof(GLuint));
+            if (pass == 1)
+            {
+                // One work group walks all the counts
+                glDispatchCompute(1, 1, 1);
+            }
+            else
+            {
+                // A work group's worth of invocations covers CULL_GROUP_PARTICLES particles
+                dispatchParticles(shardSize(shard), CULL_GROUP_PARTICLES);
+            }
+        }
+        glMemoryBarrier(pass < 2 ? GL_SHADER_STORAGE_BARRIER_BIT : GL_SHADER_STORAGE_BARRIER_BIT | GL_COMMAND_BARRIER_BIT);
+    }
+}
+
+// What the last cullParticles() did, over all shards
+struct CullStats {
+    size_t drawn;           // particles left to draw
+    size_t blocks;          // block bounding boxes
+    size_t blocksOutside;   // dropped whole, without reading their particles
+    size_t blocksInside;    // kept whole, likewise
+};
+
+CullStats readCullStats()
+{
+    // Read back from the draw commands, see cull.glsl's DrawCommand.
+    // Waits on the GPU, only for reporting
+    CullStats stats = CullStats();
+    for (size_t shard = 0; shard < shardCount(); shard++)
+    {
+        GLuint command[8] = {0, 0, 0, 0, 0, 0, 0, 0};
+        glBindBuffer(GL_COPY_READ_BUFFER, shards[shard].commandBuffer);
+        glGetBufferSubData(GL_COPY_READ_BUFFER, 0, sizeof(command), command);
+        stats.drawn += command[0];
+        stats.blocks += (shardSize(shard) + BLOCK_PARTICLES - 1) / BLOCK_PARTICLES;
+        stats.blocksOutside += command[6];
+        stats.blocksInside += command[7];
+    }
+    return stats;
+}
+
+void drawParticles()
+{
+    // swap to basic vertex shader
+    // The first frame can come before startup has finished compiling it
+    finishProgram(&renderShader);
+    glUseProgram(renderShader);
+    // update uniforms, mainly (M)VP matrices
+    updateRenderShader();
+    if (colorFromVelocity)
+    {
+        // The table only gets rewritten when the colors drift or are edited
+        glm::vec3 startColor, endColor;
+        currentColors(startColor, endColor);
+        colorLUT.update(startColor, endColor);
+        colorLUT.bind(0);
+    }
+    if (frustumCulling)
+    {
+        gpuTimer.begin(PASS_CULL);
+        cullParticles();
+        gpuTimer.end(PASS_CULL);
+        glUseProgram(renderShader);
+    }
+    // draw
+    gpuTimer.begin(PASS_DRAW);
+    // gl_VertexID counts from 0 in every shard, same as the shard's arrays
+    // (or VisibleIndices' when culling)
+    for (size_t shard = 0; shard < shardCount(); shard++)
+    {
+        bindShard(shard);
+        if (frustumCulling)
+        {
+            // The vertex count is whatever cull.glsl wrote into the command
+            glBindBufferRange(GL_SHADER_STORAGE_BUFFER, 7, shards[shard].visibleSSbo, 0, shardSize(shard) * sizeof(GLuint));
+            glBindBuffer(GL_DRAW_INDIRECT_BUFFER, shards[shard].commandBuffer);
+            glDrawArraysIndirect(GL_POINTS, 0);
+        }
+        else
+        {
+            glDrawArrays(GL_POINTS, 0, (GLsizei)shardSize(shard));
+        }
+    }
+    gpuTimer.end(PASS_DRAW);
 }
 
-int main()
+void printUsage(const char *program)
 {
+    printf("Usage: %s [options]\n", program);
+    printf("  --headless          no window, render offscreen with EGL (or OSMesa)\n");
+    printf("  --frames N          headless: frames to run before exiting (default %d)\n", headlessFrames);
+    printf("  --no-render         headless: only run the simulation, never draw\n");
+    printf("  --size WxH          headless: framebuffer size (default %dx%d)\n", headlessWidth, headlessHeight);
+    printf("  --dt SECONDS        headless: fixed frame time (default %g)\n", headlessDT);
+    printf("  --screenshot FILE   headless: save the last frame as a PPM\n");
+    printf("  --particles N       number of particles (default %zu)\n", NUM_PARTICLES);
+    printf("  --shard-particles N particles per SSBO shard (default: as many as one binding holds)\n");
+    printf("  --cpu               start with the CPU backend\n");
+    printf("  --cpu-threads N     CPU backend threads (default 0, one per core this process may run on)\n");
+    printf("  --pin, --no-pin     lock CPU backend thread i to the i-th allowed core, or not (default not)\n");
+    printf("  --huge-pages MODE   CPU backend memory: off, thp or explicit (default thp)\n");
+    printf("  --color-lut         color particles from velocity in vert.glsl, no color buffer\n");
+    printf("  --compact           16-bit fixed point positions and half float velocities\n");
+    printf("  --no-cull           draw every particle, without frustum culling them in cull.glsl first\n");
+    printf("  --no-sort           never sort the particles into Morton order (sort.glsl)\n");
+    printf("  --sort-interval N   sort every N steps as well as when they get disordered (default %d, never)\n", sortInterval);
+    printf("  --sort-threshold F  sort once disorder is F of the way back to random, 0.05 to 1 (default %g)\n", sortThreshold);
+    printf("  --distribution D    initial particles: ball, shell, plummer, disk or galaxies (default ball)\n");
+    printf("  --seed N            seed for the initial particles (default %u)\n", initialConditions.seed);
+    printf("  --cpu-seed          generate the initial particles on the CPU instead of in seed.glsl\n");
+    printf("  --no-snapshot       don't keep a GPU copy of the initial particles for restarts\n");
+    printf("  --no-shader-cache   always compile shaders from source, don't read or write shader_cache/\n");
+    printf("  --shader-dir DIR    read shaders from DIR instead of the ones built in (to try out edits)\n");
+    printf("  --bench             headless benchmark sweep, see runBenchmark()\n");
+    printf("  --bench-sizes A,B   bench: particle counts (default 10000,100000,1000000,10000000,50000000)\n");
+    printf("  --bench-warmup N    bench: untimed runs before each measurement (default %d)\n", benchWarmup);
+    printf("  --bench-trials N    bench: timed runs per measurement (default %d)\n", benchTrials);
+    printf("  --bench-out FILE    bench: where to write the JSON report (default %s)\n", benchOutput);
+}
+
+bool parseArgs(int argc, char **argv)
+{
+    // Returns false if the program shouldn't run, usage has been printed by then
+    for (int i = 1; i < argc; i++)
+    {
+        std::string arg = argv[i];
+        // Options that take a value
+        bool hasValue = (i + 1 < argc);
+        if (arg == "--headless")
+        {
+            headless = true;
+        }
+        else if (arg == "--no-render")
+        {
+            headlessRender = false;
+        }
+        else if (arg == "--cpu")
+        {
+            startOnCPU = true;
+        }
+        else if (arg == "--cpu-threads" && hasValue)
+        {
+            cpuConfig.numThreads = std::max(0, atoi(argv[++i]));
+        }
+        else if (arg == "--pin")
+        {
+            cpuConfig.pinThreads = true;
+        }
+        else if (arg == "--no-pin")
+        {
+            cpuConfig.pinThreads = false;
+        }
+        else if (arg == "--huge-pages" && hasValue)
+        {
+            std::string mode = argv[++i];
+            if (mode == "off")
+            {
+                cpuConfig.hugePages = HUGEPAGES_OFF;
+            }
+            else if (mode == "thp")
+            {
+                cpuConfig.hugePages = HUGEPAGES_TRANSPARENT;
+            }
+            else if (mode == "explicit")
+            {
+                cpuConfig.hugePages = HUGEPAGES_EXPLICIT;
+            }
+            else
+            {
+                fprintf(stderr, "Unknown --huge-pages %s\n", mode.c_str());
+                return false;
+            }
+        }
+        else if (arg == "--color-lut")
+        {
+            colorFromVelocity = true;
+        }
+        else if (arg == "--compact")
+        {
+            compactStorage = true;
+        }
+        else if (arg == "--no-cull")
+        {
+            frustumCulling = false;
+        }
+        else if (arg == "--no-sort")
+        {
+            spatialSorting = false;
+        }
+        else if (arg == "--sort-interval" && hasValue)
+        {
+            sortInterval = std::max(0, atoi(argv[++i]));
+        }
+        else if (arg == "--sort-threshold" && hasValue)
+        {
+            // Same range as the slider, at 0 or below every measurement would sort again
+            sortThreshold = std::min(std::max((float)atof(argv[++i]), 0.05f), 1.0f);
+        }
+        else if (arg == "--distribution" && hasValue)
+        {
+            std::string name = argv[++i];
+            int distribution = 0;
+            while (distribution < DIST_COUNT && name != distributionName((Distribution)distribution))
+            {
+                distribution++;
+            }
+            if (distribution == DIST_COUNT)
+            {
+                fprintf(stderr, "Unknown --distribution %s\n", name.c_str());
+                return false;
+            }
+            // Keep the seed if it was given first
+            uint32_t seed = initialConditions.seed;
+            initialConditions = defaultInitialConditions((Distribution)distribution);
+            initialConditions.seed = seed;
+        }
+        else if (arg == "--cpu-seed")
+        {
+            gpuSeeding = false;
+        }
+        else if (arg == "--no-snapshot")
+        {
+            keepSnapshot = false;
+        }
+        else if (arg == "--no-shader-cache")
+        {
+            programCache.setEnabled(false);
+        }
+        else if (arg == "--shader-dir" && hasValue)
+        {
+            shaderLibrary.setDirectory(argv[++i]);
+        }
+        else if (arg == "--seed" && hasValue)
+        {
+            initialConditions.seed = (uint32_t)strtoul(argv[++i], NULL, 10);
+        }
+        else if (arg == "--frames" && hasValue)
+        {
+            headlessFrames = atoi(argv[++i]);
+        }
+        else if (arg == "--size" && hasValue)
+        {
+            if (sscanf(argv[++i], "%dx%d", &headlessWidth, &headlessHeight) != 2 || headlessWidth < 1 || headlessHeight < 1)
+            {
+                fprintf(stderr, "Bad --size %s, expected something like 1280x720\n", argv[i]);
+                return false;
+            }
+        }
+        else if (arg == "--dt" && hasValue)
+        {
+            headlessDT = (float)atof(argv[++i]);
+        }
+        else if (arg == "--screenshot" && hasValue)
+        {
+            screenshotPath = argv[++i];
+        }
+        else if (arg == "--bench")
+        {
+            benchmark = true;
+        }
+        else if (arg == "--bench-sizes" && hasValue)
+        {
+            std::stringstream list(argv[++i]);
+            std::string size;
+            while (std::getline(list, size, ','))
+            {
+                size_t count = strtoull(size.c_str(), NULL, 10);
+                if (count < 1)
+                {
+                    fprintf(stderr, "Bad particle count %s in --bench-sizes\n", size.c_str());
+                    return false;
+                }
+                benchSizes.push_back(count);
+            }
+        }
+        else if (arg == "--bench-warmup" && hasValue)
+        {
+            benchWarmup = std::max(0, atoi(argv[++i]));
+        }
+        else if (arg == "--bench-trials" && hasValue)
+        {
+            benchTrials = std::max(1, atoi(argv[++i]));
+        }
+        else if (arg == "--bench-out" && hasValue)
+        {
+            benchOutput = argv[++i];
+        }
+        else if (arg == "--particles" && hasValue)
+        {
+            NUM_PARTICLES = strtoull(argv[++i], NULL, 10);
+            if (NUM_PARTICLES < 1)
+            {
+                fprintf(stderr, "Bad --particles %s\n", argv[i]);
+                return false;
+            }
+        }
+        else if (arg == "--shard-particles" && hasValue)
+        {
+            shardParticles = strtoull(argv[++i], NULL, 10);
+            if (shardParticles < 1 || shardParticles > INT_MAX)
+            {
+                fprintf(stderr, "Bad --shard-particles %s\n", argv[i]);
+                return false;
+            }
+        }
+        else
+        {
+            printUsage(argv[0]);
+            return false;
+        }
+    }
+    if (benchSizes.empty())
+    {
+        const size_t defaultSizes[] = {10000, 100000, 1000000, 10000000, 50000000};
+        benchSizes.assign(defaultSizes, defaultSizes + 5);
+    }
+    return true;
+}
+
+int runHeadless()
+{
+    // Same setup and frame loop as main(), minus the window, ImGui and input.
+    // Runs a fixed number of frames with a fixed timestep and reports how long they took
+    if (!gpuSeeding)
+    {
+        pregenerator.start(initialConditions, NUM_PARTICLES);
+    }
+    HeadlessContext context;
+    if (!context.init(headlessWidth, headlessHeight))
+    {
+        return 1;
+    }
+    startupTimer.mark("context");
+    // Required to allow vertex shader to scale points based on depth
+    glEnable(GL_PROGRAM_POINT_SIZE);
+    initGlobals();
+    startupTimer.mark("shaders started");
+    initShaders(NULL);
+    startupTimer.mark("particles");
+    finishStartup();
+    startupTimer.print();
+    runSim = true;
+
+    glBindFramebuffer(GL_FRAMEBUFFER, context.getFramebuffer());
+    glClearColor(clearColor.x, clearColor.y, clearColor.z, clearColor.w);
+    glFinish();
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    for (int frame = 0; frame < headlessFrames; frame++)
+    {
+        gpuTimer.beginFrame();
+        stepSimulation(headlessDT);
+        keepParticlesSorted();
+        headlessClock += headlessDT;
+        if (headlessRender)
+        {
+            glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+            drawParticles();
+        }
+        gpuTimer.endFrame();
+    }
+    // Everything above was only queued up, wait for the GPU to actually finish it
+    glFinish();
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    printf("%d frames of %zu particles on the %s (%s): %.3f s, %.3f ms/frame\n",
+           headlessFrames, NUM_PARTICLES, cpuCompute ? "CPU" : "GPU",
+           headlessRender ? "simulate + render" : "simulate only",
+           seconds, headlessFrames > 0 ? 1000.0 * seconds / headlessFrames : 0.0);
+    printf("GPU time per pass (average over up to %d frames read back):", GPU_TIMER_HISTORY);
+    for (int pass = 0; pass <= NUM_PASSES; pass++)
+    {
+        printf(" %s %.3f ms%s", gpuPassNames[pass], gpuTimer.average(pass), pass < NUM_PASSES ? "," : "\n");
+    }
+    printf("GPU particle buffers: %.1f MB (peak %.1f MB)\n", bufferPool.getCurrentBytes() / (1024.0 * 1024.0),
+           bufferPool.getPeakBytes() / (1024.0 * 1024.0));
+    printf("Shader programs: %d loaded from shader_cache/, %d compiled\n", programCache.getHits(), programCache.getMisses());
+    if (headlessRender && frustumCulling)
+    {
+        CullStats stats = readCullStats();
+        printf("Frustum culling: drew %zu of %zu particles in the last frame, %zu of %zu blocks off screen and %zu on screen as a whole\n",
+               stats.drawn, NUM_PARTICLES, stats.blocksOutside, stats.blocks, stats.blocksInside);
+    }
+    if (spatialSorting && !cpuCompute)
+    {
+        printf("Morton sort: %d sorts, the last one read back %.3f ms GPU, disorder %.3f (%.3f right after the last sort)\n",
+               sortCount, lastSortMs, lastDisorder, sortedDisorder);
+    }
+
+    if (screenshotPath != NULL)
+    {
+        if (!headlessRender)
+        {
+            // Nothing was drawn during the run, draw the final state once
+            glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+            drawParticles();
+        }
+        if (!context.saveFrame(screenshotPath))
+        {
+            return 1;
+        }
+        printf("Saved last frame to %s\n", screenshotPath);
+    }
+    return 0;
+}
+
+int runBenchmark()
+{
+    // Sweeps every particle count in benchSizes over the GPU and every CPU instruction set,
+    // each with all four collision variants, and times the draw once per count.
+    // Each measurement is benchWarmup untimed trials and benchTrials timed ones.
+    // A trial runs enough steps back to back that small counts aren't all glFinish() overhead
+    headless = true;
+    HeadlessContext context;
+    if (!context.init(headlessWidth, headlessHeight))
+    {
+        return 1;
+    }
+    // Required to allow vertex shader to scale points based on depth
+    glEnable(GL_PROGRAM_POINT_SIZE);
+    NUM_PARTICLES = benchSizes[0];
+    // Nothing is ever restarted, a snapshot would only double the memory of every size
+    keepSnapshot = false;
+    initGlobals();
+    cpuCompute = cpuCheckBoxFlag = false;
+    initShaders(NULL);
+    finishStartup();
+    glBindFramebuffer(GL_FRAMEBUFFER, context.getFramebuffer());
+    glClearColor(clearColor.x, clearColor.y, clearColor.z, clearColor.w);
+
+    BenchReport report;
+    report.setInfo("vendor", (const char *)glGetString(GL_VENDOR));
+    report.setInfo("renderer", (const char *)glGetString(GL_RENDERER));
+    report.setInfo("version", (const char *)glGetString(GL_VERSION));
+    report.setInfo("work_group_size", std::to_string(WORK_GROUP_SIZE));
+    report.setInfo("cpu_threads", std::to_string(cpuSim.getNumThreads()));
+    report.setInfo("framebuffer", std::to_string(headlessWidth) + "x" + std::to_string(headlessHeight));
+    report.setInfo("storage", std::string(compactStorage ? "compact" : "vec4") + (colorFromVelocity ? ", color from velocity" : ""));
+    report.setTrials(benchWarmup, benchTrials);
+
+    const char *variantNames[4] = {"none", "sphere", "floor", "sphere+floor"};
+
+    for (size_t sizeIndex = 0; sizeIndex < benchSizes.size(); sizeIndex++)
+    {
+        // Counts past what one SSBO can hold are sharded, only memory limits them
+        size_t size = benchSizes[sizeIndex];
+        NUM_PARTICLES = size;
+        cpuCompute = false;
+        glGetError();
+        initSSBOs();
+        if (glGetError() == GL_OUT_OF_MEMORY)
+        {
+            report.skip("all", size, "out of GPU memory");
+            continue;
+        }
+        int steps = (int)std::max((size_t)1, std::min((size_t)100, 1000000 / size));
+
+        BenchResult result;
+        result.particles = size;
+        result.stepsPerTrial = steps;
+        std::function<void()> simulateBatch = [&]() {
+            for (int step = 0; step < steps; step++)
+            {
+                stepSimulation(headlessDT);
+            }
+            glFinish();
+        };
+
+        result.phase = "simulate";
+        result.backend = "gpu";
+        result.kernel = "glsl";
+        for (int variant = 0; variant < 4; variant++)
+        {
+            boundingSphereEnable = variant & 1;
+            floorEnable = (variant >> 1) & 1;
+            computeShader = computeVariants[variant];
+            result.variant = variantNames[variant];
+            result.nsPerParticle = timeTrials(simulateBatch, benchWarmup, benchTrials, size, steps);
+            report.add(result);
+        }
+
+        // Drawing doesn't care which backend filled the SSBOs, once per count is enough
+        result.phase = "render";
+        result.variant = "-";
+        result.nsPerParticle = timeTrials([&]() {
+            for (int step = 0; step < steps; step++)
+            {
+                glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+                drawParticles();
+            }
+            glFinish();
+        }, benchWarmup, benchTrials, size, steps);
+        report.add(result);
+
+        result.phase = "simulate";
+        result.backend = "cpu";
+        cpuCompute = true;
+        downloadSSBOsToCPU();
+        KernelISA bestISA = cpuSim.getKernelISA();
+        for (int isa = 0; isa < ISA_COUNT; isa++)
+        {
+            if (!kernelISASupported((KernelISA)isa))
+            {
+                continue;
+            }
+            cpuSim.setKernelISA((KernelISA)isa);
+            result.kernel = kernelISAName((KernelISA)isa);
+            for (int variant = 0; variant < 4; variant++)
+            {
+                boundingSphereEnable = variant & 1;
+                floorEnable = (variant >> 1) & 1;
+                result.variant = variantNames[variant];
+                result.nsPerParticle = timeTrials(simulateBatch, benchWarmup, benchTrials, size, steps);
+                report.add(result);
+            }
+        }
+        cpuSim.setKernelISA(bestISA);
+        cpuCompute = false;
+    }
+
+    if (!report.writeJSON(benchOutput))
+    {
+        return 1;
+    }
+    printf("Wrote %s\n", benchOutput);
+    return 0;
+}
+
+int main(int argc, char **argv)
+{
+    if (!parseArgs(argc, argv))
+    {
+        return 1;
+    }
+    initCPUBackend();
+    if (benchmark)
+    {
+        return runBenchmark();
+    }
+    if (headless)
+    {
+        return runHeadless();
+    }
+
+    // CPU seeding doesn't need a context, it can get going before there is one
+    if (!gpuSeeding)
+    {
+        pregenerator.start(initialConditions, NUM_PARTICLES);
+    }
+
     // initialize various contexts
+    // Shaders are started before ImGui so they compile while it sets up, and the first
+    // frame goes up as soon as the particles and the render program are there
     GLFWwindow *window = initWindow(windowWidth, windowHeight, windowSizeX, windowSizeY);
-    initIMGUI(window);
+    startupTimer.mark("window");
     initGlobals();
+    startupTimer.mark("shaders started");
+    initIMGUI(window);
+    startupTimer.mark("ImGui");
     initShaders(window);
+    startupTimer.mark("particles");
+    glClearColor(clearColor.x, clearColor.y, clearColor.z, clearColor.w);
+    gpuTimer.beginFrame();
+    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+    drawParticles();
+    gpuTimer.endFrame();
+    glfwSwapBuffers(window);
+    startupTimer.mark("first frame");
+    // The simulation isn't running yet, the compute variants can take their time
+    finishStartup();
+    startupTimer.print();
 
     // initialize timing variables
     // Might as well be global honestly, everything else is at this point.
@@ -822,6 +2745,7 @@ int main()
     {
         // Update input events
         glfwPollEvents();
+        gpuTimer.beginFrame();
 
         // Clear the screen before drawing new things
         glClearColor(clearColor.x, clearColor.y, clearColor.z, clearColor.w);
@@ -835,20 +2759,12 @@ int main()
         // run compute shader
         if (runSim)
         {
-            // Swap to compute shader
-            glUseProgram(computeShader);
-            // update uniforms
-            updateComputeShader(deltaTime);
-            // actually run the compute shader
-            glDispatchCompute(NUM_PARTICLES / WORK_GROUP_SIZE, 1, 1);
+            stepSimulation(deltaTime);
+            keepParticlesSorted();
         }
 
-        // swap to basic vertex shader
-        glUseProgram(renderShader);
-        // update uniforms, mainly (M)VP matrices
-        updateRenderShader();
         // draw
-        glDrawArrays(GL_POINTS, 0, NUM_PARTICLES);
+        drawParticles();
 
         // render ImGui
         renderImGui(window);
@@ -857,6 +2773,7 @@ int main()
         }
 
         // draw frame to screen
+        gpuTimer.endFrame();
         glfwSwapBuffers(window);
 
     } // Check if the ESC key was pressed or the window was closed
@@ -0,0 +1,36 @@
+// Bounding box of every block of BLOCK_PARTICLES particles in a shard, block i being
+//  particles [i * BLOCK_PARTICLES, ...).
+// compute.glsl grows them as it moves the particles (main.cpp clears them first), and
+//  cull.glsl uses them to keep or drop whole blocks without reading their particles.
+// Six uints per block: the corners as uints that sort the same way the floats do, so
+//  atomicMax can build them. The minimum is kept as the maximum of the complement, that
+//  way both start out cleared to 0
+#ifndef BLOCK_PARTICLES
+#define BLOCK_PARTICLES 1024
+#endif
+layout( std430, binding=11 ) buffer Bounds
+{   uint BlockBounds[];  };
+
+uint orderedBits(float f)
+{
+    // Flip negatives entirely and set the sign bit of positives
+    uint u = floatBitsToUint(f);
+    return (u & 0x80000000u) != 0u ? ~u : u | 0x80000000u;
+}
+
+float orderedFloat(uint u)
+{
+    return uintBitsToFloat((u & 0x80000000u) != 0u ? u & 0x7FFFFFFFu : ~u);
+}
+
+vec3 blockMax(uint block)
+{
+    uint i = block * 6u;
+    return vec3(orderedFloat(BlockBounds[i]), orderedFloat(BlockBounds[i + 1u]), orderedFloat(BlockBounds[i + 2u]));
+}
+
+vec3 blockMin(uint block)
+{
+    uint i = block * 6u + 3u;
+    return vec3(orderedFloat(~BlockBounds[i]), orderedFloat(~BlockBounds[i + 1u]), orderedFloat(~BlockBounds[i + 2u]));
+}
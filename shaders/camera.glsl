@@ -0,0 +1,92 @@
+// Filled from main.cpp's RenderUniforms struct, uploaded only when the camera or size changes
+// Read by vert.glsl to draw and by cull.glsl to skip what wouldn't be drawn
+layout( std140, binding = 1 ) uniform RenderUniforms
+{
+    mat4 viewMat;
+    mat4 projMat;
+    vec4 compactBox;        // same cube as compute.glsl's, only used with COMPACT_STORAGE
+    float particleSizeScalar;
+    float colorScale;
+    vec2 viewportSize;      // pixels
+};
+
+vec4 clipPosition(vec4 position)
+{
+    return projMat * viewMat * position;
+}
+
+// Point size in pixels. A realistic model would divide by (z*z), but there are only so
+// many pixels in a screen
+float pointSize(vec4 clip)
+{
+    return particleSizeScalar / clip.z;
+}
+
+// Whether a point at clip could put any pixels on screen.
+// GL drops points whose center is outside the clip volume, but some implementations keep
+// wide points that still overlap the viewport, so x and y get the point's radius of slack
+bool pointVisible(vec4 clip)
+{
+    if( clip.w <= 0.0 || abs(clip.z) > clip.w )
+    {
+        return false;
+    }
+    vec2 radius = abs(pointSize(clip)) / viewportSize * clip.w;
+    return all(lessThanEqual(abs(clip.xy), vec2(clip.w) + radius));
+}
+
+// What boxVisibility() finds
+const uint BOX_OUTSIDE = 0u;    // no point in the box can be on screen
+const uint BOX_INSIDE = 1u;     // every point in the box passes pointVisible()
+const uint BOX_PARTIAL = 2u;    // it's up to each point
+
+// Clip coordinates are linear in the position, so a box whose corners are all on the same
+// side of a plane in clip space is on that side as a whole.
+// The point radius isn't linear, but with every corner past z = 0 it's at most k * w, which
+// is. Outside tests get a little slack for rounding, a point kept by mistake is just drawn
+uint boxVisibility(vec3 lo, vec3 hi)
+{
+    vec4 corners[8];
+    bool inside = true, behind = true, beforeNear = true, pastFar = true;
+    float minZ = 1e30;
+    for( int i = 0; i < 8; i++ )
+    {
+        vec3 corner = vec3((i & 1) != 0 ? hi.x : lo.x, (i & 2) != 0 ? hi.y : lo.y, (i & 4) != 0 ? hi.z : lo.z);
+        vec4 clip = clipPosition(vec4(corner, 1.0));
+        corners[i] = clip;
+        float slack = 1e-3 * abs(clip.w);
+        inside = inside && clip.w > 0.0 && all(lessThanEqual(abs(clip.xyz), vec3(clip.w)));
+        behind = behind && clip.w < 0.0;
+        beforeNear = beforeNear && clip.z < -clip.w - slack;
+        pastFar = pastFar && clip.z > clip.w + slack;
+        minZ = min(minZ, clip.z);
+    }
+    if( inside )
+    {
+        return BOX_INSIDE;
+    }
+    if( behind || beforeNear || pastFar )
+    {
+        return BOX_OUTSIDE;
+    }
+    if( minZ > 0.0 )
+    {
+        // Every point's radius is at most k * w, see pointVisible()
+        vec2 edge = (1.0 + abs(particleSizeScalar) / (minZ * viewportSize)) * 1.001;
+        bool left = true, right = true, below = true, above = true;
+        for( int i = 0; i < 8; i++ )
+        {
+            // With a perspective projection z > 0 means w > 0 too
+            vec2 reach = edge * corners[i].w;
+            left = left && corners[i].x < -reach.x;
+            right = right && corners[i].x > reach.x;
+            below = below && corners[i].y < -reach.y;
+            above = above && corners[i].y > reach.y;
+        }
+        if( left || right || below || above )
+        {
+            return BOX_OUTSIDE;
+        }
+    }
+    return BOX_PARTIAL;
+}
@@ -0,0 +1,25 @@
+// COMPACT_STORAGE encoding, exactly like common/CompactParticles.h does it on the CPU.
+// Positions are 16-bit fixed point inside the cube box (xyz center, w half side),
+//  velocities are half floats
+#ifdef COMPACT_STORAGE
+vec3 decodePosition(uvec2 q, vec4 box)
+{
+    vec3 unit = vec3(q.x & 0xFFFFu, q.x >> 16, q.y & 0xFFFFu) / 65535.0;
+    return box.xyz + (unit * 2.0 - 1.0) * box.w;
+}
+uvec2 encodePosition(vec3 p, vec4 box)
+{
+    // Anything outside the cube sticks to its faces
+    vec3 unit = clamp((p - box.xyz) / box.w * 0.5 + 0.5, 0.0, 1.0);
+    uvec3 q = uvec3(unit * 65535.0 + 0.5);
+    return uvec2(q.x | (q.y << 16), q.z);
+}
+vec3 decodeVelocity(uvec2 h)
+{
+    return vec3(unpackHalf2x16(h.x), unpackHalf2x16(h.y).x);
+}
+uvec2 encodeVelocity(vec3 v)
+{
+    return uvec2(packHalf2x16(v.xy), packHalf2x16(vec2(v.z, 0.0)));
+}
+#endif
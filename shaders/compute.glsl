@@ -4,29 +4,45 @@
 
 //Compute shader
 // Uses a Position, Velocity, and Color SSBO as input and output
-layout( std430, binding=4 ) buffer Pos
-{   vec4 Positions[];  };
-layout( std430, binding=5 ) buffer Vel
-{   vec4 Velocities[]; };
-layout( std430, binding=6 ) buffer Col
-{   vec4 Colors[];  };
+#include "particles.glsl"
 
-// local work group is 100 large. I believe ideal local size would be GCD(num_cores, num_particles)
-// More testing needed
-layout( local_size_x = 100, local_size_y = 1, local_size_z = 1 ) in;
+// The best local work group size depends a lot on the device, so main.cpp times a
+// range of them at startup (see common/WorkGroupTuner.h) and injects the winner.
+// 100 is what it always used to be.
+#ifndef WORK_GROUP_SIZE
+#define WORK_GROUP_SIZE 100
+#endif
+layout( local_size_x = WORK_GROUP_SIZE, local_size_y = 1, local_size_z = 1 ) in;
+
+// Collisions are compiled in or out rather than checked every invocation.
+// main.cpp builds one program per combination by injecting these after #version:
+//  #define SPHERE_ENABLE   particles are kept inside the bounding sphere
+//  #define FLOOR_ENABLE    particles bounce off the floor plane
+// And when vert.glsl works out colors itself there's no Col buffer to write:
+//  #define COLOR_FROM_VELOCITY
+// Positions as 16-bit fixed point and velocities as half floats:
+//  #define COMPACT_STORAGE
+// Bounding boxes of every BLOCK_PARTICLES particles, for cull.glsl:
+//  #define BLOCK_BOUNDS
 
 // uniform control variables
-uniform int sphereEnable;
-uniform int floorEnable;
-uniform float blackHoleAccel;
-uniform float DT;
-uniform float colorScale;
-uniform float floorPos;
-uniform vec3 blackHole1;    //xyz position
-uniform vec3 blackHole2;
-uniform vec3 startColor;
-uniform vec3 endColor;
-uniform vec4 sphere;        //xyz position, w radius
+// One std140 block, main.cpp fills a matching struct (SimUniforms) and only uploads it
+//  when something changed. The binding is fixed so every variant reads the same buffer.
+// Each vec3 shares its 16 bytes with the float after it, keep the order in sync with main.cpp
+layout( std140, binding = 0 ) uniform SimUniforms
+{
+    vec3 blackHole1;        //xyz position
+    float blackHoleAccel;
+    vec3 blackHole2;
+    float DT;
+    vec3 startColor;
+    float colorScale;
+    vec3 endColor;
+    float floorPos;
+    vec4 sphere;            //xyz position, w radius
+    vec4 compactBox;        //xyz center, w half side of the fixed point cube (COMPACT_STORAGE)
+    uint particleCount;
+};
 
 // Function just checks if a position is inside of a sphere or not
 bool isInsideSphere( vec3 p, vec4 s )
@@ -47,17 +63,23 @@ vec3 accelTowardsBH(vec3 pPos, vec3 bhPos){
     return accelVec;
 }
 
-void main() {
+#include "compact.glsl"
+#include "dispatch.glsl"
+
+// Moves particle gid one step, returns where it is now as it was stored
+vec3 stepParticle(uint gid)
+{
     // used in color picking
     const float e = 2.7182818284;
 
-    // gid used as index into SSBO to find the particle
-    // that any particular instance is controlling
-    uint gid = gl_GlobalInvocationID.x;
-
     // Get position and velocity of this particle
+#ifdef COMPACT_STORAGE
+    vec3 p = decodePosition(Positions[gid], compactBox);
+    vec3 v = decodeVelocity(Velocities[gid]);
+#else
     vec3 p = Positions[gid].xyz;
     vec3 v = Velocities[gid].xyz;
+#endif
 
     // Update acceleration towards both masses
     vec3 accelVec = accelTowardsBH(p, blackHole1);
@@ -71,7 +93,8 @@ void main() {
     vec3 pp = p + v*DT + 0.5*DT*DT*accelVec*sign(DT);
     vec3 vp = v + accelVec*DT;
 
-    if( sphereEnable == 1 && !isInsideSphere( pp, sphere ) )
+#ifdef SPHERE_ENABLE
+    if( !isInsideSphere( pp, sphere ) )
     {
         // If new point is outside of the sphere, and the sphere should exist
         // Set new point to be very close to the edge of the sphere
@@ -79,7 +102,9 @@ void main() {
         pp = (normalize(pp) * (sphere.w-1.0)) + sphere.xyz;
         vp = vec3(0, 0, 0);
     }
-    if( floorEnable == 1 && pp.y < floorPos)
+#endif
+#ifdef FLOOR_ENABLE
+    if( pp.y < floorPos )
     {
         // Currently only support major axis planes, and one where the normal
         //  is in the +Z direction at that
@@ -88,7 +113,9 @@ void main() {
         pp.y = floorPos+1.0;
         vp = reflect(vp, vec3(0, 1, 0));
     }
+#endif
 
+#ifndef COLOR_FROM_VELOCITY
     // scale between two colors based on particle velocity
     float lengthVP = length(vp);
     // (1-e^(-kx)) used here
@@ -99,8 +126,62 @@ void main() {
     // as we add in the final (high-speed) color
     outColor += endColor*scale;
 
-    // Update new position, velocity, and color in SSBO for rendering
+    Colors[gid] = vec4(outColor, 1.0);
+#endif
+
+    // Update new position and velocity in SSBO for rendering
+#ifdef COMPACT_STORAGE
+    uvec2 stored = encodePosition(pp, compactBox);
+    Positions[gid] = stored;
+    Velocities[gid] = encodeVelocity(vp);
+    // Anything reading it back gets the fixed point version
+    return decodePosition(stored, compactBox);
+#else
     Positions[gid].xyz = pp;
     Velocities[gid].xyz = vp;
-    Colors[gid] = vec4(outColor, 1.0);
+    return pp;
+#endif
+}
+
+#ifdef BLOCK_BOUNDS
+#include "bounds.glsl"
+
+// Grows one corner value of a block's box. Boxes only ever grow, and most particles
+// aren't on the edge of theirs, so the value is read first and the atomic only done
+// when it would change something. A stale read just costs an atomic that wasn't needed
+void growBound(uint i, uint value)
+{
+    if( value > BlockBounds[i] )
+    {
+        atomicMax(BlockBounds[i], value);
+    }
+}
+
+// Grows the box of p's block by p
+void growBlockBounds(uint gid, vec3 p)
+{
+    uint i = gid / uint(BLOCK_PARTICLES) * 6u;
+    growBound(i, orderedBits(p.x));
+    growBound(i + 1u, orderedBits(p.y));
+    growBound(i + 2u, orderedBits(p.z));
+    growBound(i + 3u, ~orderedBits(p.x));
+    growBound(i + 4u, ~orderedBits(p.y));
+    growBound(i + 5u, ~orderedBits(p.z));
+}
+#endif
+
+void main() {
+    // gid used as index into SSBO to find the particle
+    // that any particular instance is controlling
+    uint gid = invocationIndex();
+    // The particle count is rarely a multiple of the work group size, and the grid is
+    // rounded up to whole rows, so the last few invocations have nothing to do
+    if( gid >= particleCount )
+    {
+        return;
+    }
+    vec3 p = stepParticle(gid);
+#ifdef BLOCK_BOUNDS
+    growBlockBounds(gid, p);
+#endif
 }
\ No newline at end of file
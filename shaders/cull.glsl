@@ -0,0 +1,192 @@
+#version 430 core
+#extension GL_ARB_compute_shader : enable
+#extension GL_ARB_shader_storage_buffer_object : enable
+
+// Frustum culling compute shader
+// Writes the indices of the particles that can be on screen into VisibleIndices, in their
+//  original order, and how many there are into a glDrawArraysIndirect command.
+// Keeping the order keeps the picture exactly the same: there's no depth test, later
+//  points are drawn over earlier ones.
+// Three passes over one shard, picked by CULL_PASS:
+//  0: every invocation tests CULL_PER_THREAD particles in a row and keeps the result as
+//     bits in InvocationMasks, along with where its first visible one goes in the group.
+//     Every work group counts its visible particles into GroupCounts.
+//     With the block bounds compute.glsl left behind, blocks that are entirely on or off
+//     screen are settled without reading their particles
+//  1: a single work group turns the counts into offsets and writes the draw command
+//  2: every invocation writes its visible particles' indices, no testing or scanning again
+#include "particles.glsl"
+#include "camera.glsl"
+#include "compact.glsl"
+#include "bounds.glsl"
+
+#ifndef CULL_GROUP_SIZE
+#define CULL_GROUP_SIZE 256
+#endif
+#ifndef CULL_PER_THREAD
+#define CULL_PER_THREAD 8       // at most 32, they're kept as bits of a uint
+#endif
+layout( local_size_x = CULL_GROUP_SIZE, local_size_y = 1, local_size_z = 1 ) in;
+#include "dispatch.glsl"
+// Blocks per work group, main.cpp makes sure it's a whole number
+#define GROUP_BLOCKS (CULL_GROUP_SIZE * CULL_PER_THREAD / BLOCK_PARTICLES)
+
+layout( std430, binding=7 ) buffer Visible
+{   uint VisibleIndices[];  };
+layout( std430, binding=8 ) buffer Groups
+{   uint GroupCounts[];  };
+// Laid out like glDrawArraysIndirect wants it
+layout( std430, binding=9 ) buffer DrawCommand
+{
+    uint count;
+    uint instanceCount;
+    uint first;
+    uint baseInstance;
+    // Not part of the command: blocks pass 0 settled as a whole, off and on screen,
+    //  and the same from the last full run for main.cpp to read back
+    uint blocksOutside;
+    uint blocksInside;
+    uint lastBlocksOutside;
+    uint lastBlocksInside;
+};
+// Per invocation: which of its particles are visible, and how many visible ones come
+//  before its first in the work group
+layout( std430, binding=10 ) buffer Masks
+{   uvec2 InvocationMasks[];  };
+
+// Mirrors main.cpp's CullUniforms
+layout( std140, binding = 3 ) uniform CullUniforms
+{
+    uint particleCount;     // in this shard
+    uint groupCount;        // work groups over them, CULL_GROUP_SIZE * CULL_PER_THREAD particles each
+    uint useBlockBounds;    // 0 when the bounds are out of date
+};
+
+shared uint scan[CULL_GROUP_SIZE];
+shared uint blockVisibility[GROUP_BLOCKS];
+
+bool particleVisible(uint gid)
+{
+    if( gid >= particleCount )
+    {
+        return false;
+    }
+#ifdef COMPACT_STORAGE
+    vec4 position = vec4(decodePosition(Positions[gid], compactBox), 1.0);
+#else
+    vec4 position = Positions[gid];
+#endif
+    return pointVisible(clipPosition(position));
+}
+
+// Inclusive prefix sum of scan[], across the work group
+void scanGroup()
+{
+    uint local = gl_LocalInvocationID.x;
+    for( uint offset = 1u; offset < uint(CULL_GROUP_SIZE); offset <<= 1 )
+    {
+        barrier();
+        uint add = local >= offset ? scan[local - offset] : 0u;
+        barrier();
+        scan[local] += add;
+    }
+    barrier();
+}
+
+void main() {
+    uint local = gl_LocalInvocationID.x;
+#if CULL_PASS == 0
+    // The grid can be rounded up past groupCount, those groups have nothing to count
+    uint group = workGroupIndex();
+    uint invocation = group * uint(CULL_GROUP_SIZE) + local;
+    // Each block is looked at once, then its invocations go by that
+    if( local < uint(GROUP_BLOCKS) )
+    {
+        uint block = group * uint(GROUP_BLOCKS) + local;
+        uint visibility = BOX_PARTIAL;
+        if( useBlockBounds != 0u && block * uint(BLOCK_PARTICLES) < particleCount )
+        {
+            visibility = boxVisibility(blockMin(block), blockMax(block));
+            if( visibility == BOX_OUTSIDE )
+            {
+                atomicAdd(blocksOutside, 1u);
+            }
+            else if( visibility == BOX_INSIDE )
+            {
+                atomicAdd(blocksInside, 1u);
+            }
+        }
+        blockVisibility[local] = visibility;
+    }
+    barrier();
+    uint visibility = blockVisibility[local * uint(CULL_PER_THREAD) / uint(BLOCK_PARTICLES)];
+    // Bit k set if the invocation's k-th particle can be on screen
+    uint mask = 0u;
+    for( uint k = 0u; k < uint(CULL_PER_THREAD) && visibility != BOX_OUTSIDE; k++ )
+    {
+        uint gid = invocation * uint(CULL_PER_THREAD) + k;
+        if( visibility == BOX_INSIDE ? gid < particleCount : particleVisible(gid) )
+        {
+            mask |= 1u << k;
+        }
+    }
+    uint visible = uint(bitCount(mask));
+    scan[local] = visible;
+    scanGroup();
+    if( group < groupCount )
+    {
+        InvocationMasks[invocation] = uvec2(mask, scan[local] - visible);
+        if( local == 0u )
+        {
+            GroupCounts[group] = scan[CULL_GROUP_SIZE - 1];
+        }
+    }
+#elif CULL_PASS == 1
+    // Exclusive prefix sum of GroupCounts in place, a work group's worth at a time
+    uint total = 0u;
+    for( uint base = 0u; base < groupCount; base += uint(CULL_GROUP_SIZE) )
+    {
+        uint i = base + local;
+        uint value = i < groupCount ? GroupCounts[i] : 0u;
+        scan[local] = value;
+        scanGroup();
+        if( i < groupCount )
+        {
+            GroupCounts[i] = total + scan[local] - value;
+        }
+        total += scan[CULL_GROUP_SIZE - 1];
+        // Everyone has to have read scan[] before the next chunk overwrites it
+        barrier();
+    }
+    if( local == 0u )
+    {
+        count = total;
+        instanceCount = 1u;
+        first = 0u;
+        baseInstance = 0u;
+        // Start the block counts over for the next run
+        lastBlocksOutside = blocksOutside;
+        lastBlocksInside = blocksInside;
+        blocksOutside = 0u;
+        blocksInside = 0u;
+    }
+#else
+    uint group = workGroupIndex();
+    if( group >= groupCount )
+    {
+        return;
+    }
+    uint invocation = group * uint(CULL_GROUP_SIZE) + local;
+    uvec2 mask = InvocationMasks[invocation];
+    // Where this invocation's first visible particle goes, the rest follow it
+    uint offset = GroupCounts[group] + mask.y;
+    for( uint k = 0u; k < uint(CULL_PER_THREAD); k++ )
+    {
+        if( (mask.x & (1u << k)) != 0u )
+        {
+            VisibleIndices[offset] = invocation * uint(CULL_PER_THREAD) + k;
+            offset++;
+        }
+    }
+#endif
+}
@@ -0,0 +1,14 @@
+// Index of this invocation among all of the dispatch's invocations.
+// Big counts are dispatched as a 2D (or 3D) grid of groups, see common/ComputeDispatch.h.
+// The grid is rounded up to whole groups and rows, callers skip indices past their count
+uint invocationIndex()
+{
+    uvec3 size = gl_NumWorkGroups * gl_WorkGroupSize;
+    return gl_GlobalInvocationID.x + size.x * (gl_GlobalInvocationID.y + size.y * gl_GlobalInvocationID.z);
+}
+
+// Index of this invocation's work group, flattened the same way
+uint workGroupIndex()
+{
+    return gl_WorkGroupID.x + gl_NumWorkGroups.x * (gl_WorkGroupID.y + gl_NumWorkGroups.y * gl_WorkGroupID.z);
+}
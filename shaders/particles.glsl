@@ -0,0 +1,19 @@
+// Position, Velocity and Color SSBOs, the same for every shader that touches particles.
+// main.cpp binds one shard of each at a time, just its particles, see bindShard()
+#ifdef COMPACT_STORAGE
+// 8 bytes per particle instead of 16, see common/CompactParticles.h
+layout( std430, binding=4 ) buffer Pos
+{   uvec2 Positions[];  };
+layout( std430, binding=5 ) buffer Vel
+{   uvec2 Velocities[]; };
+#else
+layout( std430, binding=4 ) buffer Pos
+{   vec4 Positions[];  };
+layout( std430, binding=5 ) buffer Vel
+{   vec4 Velocities[]; };
+#endif
+// No Col buffer when vert.glsl works colors out from the velocity
+#ifndef COLOR_FROM_VELOCITY
+layout( std430, binding=6 ) buffer Col
+{   vec4 Colors[];  };
+#endif
@@ -0,0 +1,189 @@
+#version 430 core
+#extension GL_ARB_compute_shader : enable
+#extension GL_ARB_shader_storage_buffer_object : enable
+
+// Seeding compute shader
+// Writes the initial particles straight into the SSBOs, nothing goes over the bus.
+// This is common/InitialConditions.h on the GPU: the same Philox4x32-10 keyed by the seed,
+//  with gl_GlobalInvocationID as the particle index, and the same distributions.
+// Only the float math (log, pow, sqrt) can round differently, so the GPU and CPU give the
+//  same particles up to the last bits.
+// Gets the same #defines as compute.glsl. Colors are cleared to white by main.cpp
+#include "particles.glsl"
+
+#ifndef WORK_GROUP_SIZE
+#define WORK_GROUP_SIZE 100
+#endif
+layout( local_size_x = WORK_GROUP_SIZE, local_size_y = 1, local_size_z = 1 ) in;
+
+// Mirrors main.cpp's SeedUniforms, and the InitialConditions struct it's filled from
+layout( std140, binding = 2 ) uniform SeedUniforms
+{
+    vec4 compactBox;        //xyz center, w half side of the fixed point cube (COMPACT_STORAGE)
+    float radius;
+    float speed;
+    float centralAccel;
+    float separation;
+    float approachSpeed;
+    uint seed;
+    uint distribution;      // Distribution enum in InitialConditions.h
+    uint particleCount;     // in this shard
+    uint firstParticle;     // particles before this one are left alone (growing in place)
+    uint particleBase;      // index of the shard's first particle among all of them,
+    uint particleBaseHigh;  //  split in 32-bit halves so counts past 2^32 still work
+};
+
+#include "compact.glsl"
+#include "dispatch.glsl"
+
+#define DIST_BALL 0u
+#define DIST_SHELL 1u
+#define DIST_PLUMMER 2u
+#define DIST_DISK 3u
+
+const float TWO_PI = 6.2831853;
+
+uvec4 philox4x32(uvec4 c, uvec2 k)
+{
+    for( int round = 0; round < 10; round++ )
+    {
+        uint hi0, lo0, hi1, lo1;
+        umulExtended(0xD2511F53u, c.x, hi0, lo0);
+        umulExtended(0xCD9E8D57u, c.z, hi1, lo1);
+        c = uvec4(hi1 ^ c.y ^ k.x, lo1, hi0 ^ c.w ^ k.y, lo0);
+        k += uvec2(0x9E3779B9u, 0xBB67AE85u);
+    }
+    return c;
+}
+
+// ParticleRandom, one per invocation
+uint rngIndex = 0u;
+uint rngIndexHigh = 0u;
+uint rngBlock = 0u;
+int rngUsed = 4;
+uvec4 rngBits;
+
+uint nextRandom()
+{
+    if( rngUsed == 4 )
+    {
+        rngBits = philox4x32(uvec4(rngIndex, rngIndexHigh, rngBlock, 0u), uvec2(seed, 0x5EED5EEDu));
+        rngBlock++;
+        rngUsed = 0;
+    }
+    return rngBits[rngUsed++];
+}
+// In (0, 1)
+float uniformRandom()
+{
+    return (float(nextRandom() >> 8) + 0.5) * (1.0 / 16777216.0);
+}
+float between(float a, float b)
+{
+    return a + (b - a) * uniformRandom();
+}
+float normalRandom()
+{
+    float r = sqrt(-2.0 * log(uniformRandom()));
+    return r * cos(TWO_PI * uniformRandom());
+}
+vec3 randomDirection()
+{
+    float z = between(-1.0, 1.0);
+    float phi = TWO_PI * uniformRandom();
+    float r = sqrt(max(0.0, 1.0 - z * z));
+    return vec3(r * cos(phi), r * sin(phi), z);
+}
+
+void exponentialDisk(float scaleLength, float mass, out vec3 p, out vec3 v)
+{
+    float r = -scaleLength * log(uniformRandom() * uniformRandom());
+    r = max(r, 0.05 * scaleLength);
+    float phi = TWO_PI * uniformRandom();
+    float height = 0.05 * scaleLength * normalRandom();
+    vec3 radial = vec3(cos(phi), 0.0, sin(phi));
+    p = radial * r + vec3(0.0, height, 0.0);
+    vec3 tangent = vec3(-radial.z, 0.0, radial.x);
+    // One statement per draw, in the same order as the CPU
+    vec3 jitter;
+    jitter.x = normalRandom();
+    jitter.y = normalRandom();
+    jitter.z = normalRandom();
+    v = tangent * sqrt(mass / r) + speed * jitter;
+}
+
+void main() {
+    uint gid = firstParticle + invocationIndex();
+    if( gid >= particleCount )
+    {
+        return;
+    }
+    // The RNG and the galaxies go by the overall index, so sharding changes nothing
+    uint carry;
+    uint index = uaddCarry(particleBase, gid, carry);
+    rngIndex = index;
+    rngIndexHigh = particleBaseHigh + carry;
+
+    vec3 p, v;
+    if( distribution == DIST_BALL )
+    {
+        vec3 direction = randomDirection();
+        p = direction * (radius * pow(uniformRandom(), 1.0 / 3.0));
+        direction = randomDirection();
+        v = direction * (speed * pow(uniformRandom(), 1.0 / 3.0));
+    }
+    else if( distribution == DIST_SHELL )
+    {
+        vec3 direction = randomDirection();
+        p = direction * (radius * between(0.98, 1.0));
+        direction = randomDirection();
+        v = direction * (speed * pow(uniformRandom(), 1.0 / 3.0));
+    }
+    else if( distribution == DIST_PLUMMER )
+    {
+        float mass = min(uniformRandom(), 0.999);
+        float r = 1.0 / sqrt(pow(mass, -2.0 / 3.0) - 1.0);
+        float q = 0.0;
+        for( int attempt = 0; attempt < 64; attempt++ )
+        {
+            q = uniformRandom();
+            float g = q * q * pow(1.0 - q * q, 3.5);
+            if( 0.1 * uniformRandom() < g )
+            {
+                break;
+            }
+        }
+        float escape = sqrt(2.0) * pow(1.0 + r * r, -0.25);
+        vec3 direction = randomDirection();
+        p = direction * (r * radius);
+        direction = randomDirection();
+        v = direction * (q * escape * speed);
+    }
+    else if( distribution == DIST_DISK )
+    {
+        exponentialDisk(radius, centralAccel, p, v);
+    }
+    else
+    {
+        // Two galaxies, see generateParticle()
+        uint galaxy = index & 1u;
+        exponentialDisk(0.6 * radius, 0.5 * centralAccel, p, v);
+        if( galaxy == 1u )
+        {
+            float c = cos(1.0471976), s = sin(1.0471976);
+            p = vec3(p.x, c * p.y - s * p.z, s * p.y + c * p.z);
+            v = vec3(v.x, c * v.y - s * v.z, s * v.y + c * v.z);
+        }
+        float side = galaxy == 0u ? -1.0 : 1.0;
+        p += vec3(side * 0.5 * separation, 0.0, side * 0.125 * separation);
+        v += vec3(-side * 0.5 * approachSpeed, 0.0, 0.0);
+    }
+
+#ifdef COMPACT_STORAGE
+    Positions[gid] = encodePosition(p, compactBox);
+    Velocities[gid] = encodeVelocity(v);
+#else
+    Positions[gid] = vec4(p, 1.0);
+    Velocities[gid] = vec4(v, 0.0);
+#endif
+}
@@ -0,0 +1,297 @@
+#version 430 core
+#extension GL_ARB_compute_shader : enable
+#extension GL_ARB_shader_storage_buffer_object : enable
+
+// Spatial sort compute shader
+// Puts one shard's particles in Morton order: by a 30-bit key that interleaves the bits of
+//  their x, y and z in the box around all of them, so particles next to each other in the
+//  buffers are close in space too.
+// An LSD radix sort of (key, index) pairs, 4 bits a round, then every attribute is
+//  gathered into the new order. Passes, picked by SORT_PASS:
+//  SORT_BOUNDS    grows the box around every shard's particles, main.cpp clears it first
+//  SORT_KEYS      Keys[i] = key of particle i, Indices[i] = i
+//  SORT_COUNT     every work group counts the keys it has of each digit into Counts
+//  SORT_SCAN      a single work group turns the counts into where each group's keys of
+//                 each digit go: all of digit 0 from every group first, then digit 1...
+//  SORT_SCATTER   every work group writes its keys and indices there, in order
+//  SORT_GATHER    Sorted[i] = Unsorted[Indices[i]], SORT_WORDS uints per particle
+//  SORT_DISORDER  how far apart in the octree particles 8i and 8i+1 are, added up
+// Each invocation of the bounds, counting and scattering passes handles SORT_PER_THREAD
+//  particles in a row, it's what keeps the scatter stable
+#define SORT_BOUNDS 0
+#define SORT_KEYS 1
+#define SORT_COUNT 2
+#define SORT_SCAN 3
+#define SORT_SCATTER 4
+#define SORT_GATHER 5
+#define SORT_DISORDER 6
+
+#include "particles.glsl"
+#include "compact.glsl"
+#include "bounds.glsl"
+
+#ifndef SORT_GROUP_SIZE
+#define SORT_GROUP_SIZE 256
+#endif
+#ifndef SORT_PER_THREAD
+#define SORT_PER_THREAD 8
+#endif
+#define RADIX 16u
+layout( local_size_x = SORT_GROUP_SIZE, local_size_y = 1, local_size_z = 1 ) in;
+#include "dispatch.glsl"
+
+// Mirrors main.cpp's SortUniforms
+layout( std140, binding = 4 ) uniform SortUniforms
+{
+    vec4 compactBox;        // same as compute.glsl's
+    uint particleCount;     // in this shard
+    uint groupCount;        // counting/scattering work groups, SORT_GROUP_SIZE * SORT_PER_THREAD keys each
+    uint shift;             // lowest bit of this round's digit
+};
+
+// The box keys are made in, as ordered bits like bounds.glsl's, and what SORT_DISORDER
+//  adds up
+layout( std430, binding=17 ) buffer SortState
+{
+    uint extentMax[3];
+    uint extentMin[3];      // complemented
+    uint disorderSum;
+};
+
+#if SORT_PASS == SORT_GATHER
+layout( std430, binding=12 ) readonly buffer Order
+{   uint Indices[];  };
+layout( std430, binding=14 ) readonly buffer Unsorted
+{   uint UnsortedWords[];  };
+layout( std430, binding=15 ) writeonly buffer Sorted
+{   uint SortedWords[];  };
+#elif SORT_PASS != SORT_BOUNDS && SORT_PASS != SORT_DISORDER
+layout( std430, binding=12 ) buffer Order
+{   uint Indices[];  };
+layout( std430, binding=13 ) buffer KeysIn
+{   uint Keys[];  };
+layout( std430, binding=14 ) buffer IndicesOut
+{   uint SortedIndices[];  };
+layout( std430, binding=15 ) buffer KeysOut
+{   uint SortedKeys[];  };
+layout( std430, binding=16 ) buffer Counts
+{   uint DigitCounts[];  };   // RADIX * groupCount, digit major
+#endif
+
+// 10 bits of x spread out to every third bit
+uint spreadBits(uint x)
+{
+    x &= 0x3FFu;
+    x = (x | (x << 16)) & 0x030000FFu;
+    x = (x | (x << 8)) & 0x0300F00Fu;
+    x = (x | (x << 4)) & 0x030C30C3u;
+    x = (x | (x << 2)) & 0x09249249u;
+    return x;
+}
+
+vec3 particlePosition(uint gid)
+{
+#ifdef COMPACT_STORAGE
+    return decodePosition(Positions[gid], compactBox);
+#else
+    return Positions[gid].xyz;
+#endif
+}
+
+uint mortonKey(uint gid)
+{
+    vec3 lo = vec3(orderedFloat(~extentMin[0]), orderedFloat(~extentMin[1]), orderedFloat(~extentMin[2]));
+    vec3 hi = vec3(orderedFloat(extentMax[0]), orderedFloat(extentMax[1]), orderedFloat(extentMax[2]));
+    // 1024 cells along each side, a flat box just has them thinner
+    vec3 unit = (particlePosition(gid) - lo) / max(hi - lo, vec3(1e-6));
+    uvec3 q = min(uvec3(clamp(unit, 0.0, 1.0) * 1024.0), uvec3(1023u));
+    return spreadBits(q.x) | (spreadBits(q.y) << 1) | (spreadBits(q.z) << 2);
+}
+
+// The work group's count of each digit when counting, where its first key of each goes
+//  when scattering
+shared uint groupCounts[RADIX];
+shared uint groupExtent[6];
+shared uint scan[SORT_GROUP_SIZE];
+// Every invocation's count of each digit, 16 bits each: digits 0-7 in the low vectors,
+//  8-15 in the high ones. A work group has fewer keys than 16 bits count to
+shared uvec4 scanLow[SORT_GROUP_SIZE];
+shared uvec4 scanHigh[SORT_GROUP_SIZE];
+
+// Inclusive prefix sum of scan[], across the work group
+void scanGroup()
+{
+    uint local = gl_LocalInvocationID.x;
+    for( uint offset = 1u; offset < uint(SORT_GROUP_SIZE); offset <<= 1 )
+    {
+        barrier();
+        uint add = local >= offset ? scan[local - offset] : 0u;
+        barrier();
+        scan[local] += add;
+    }
+    barrier();
+}
+
+// Same for all 16 digit counts at once
+void scanDigits()
+{
+    uint local = gl_LocalInvocationID.x;
+    for( uint offset = 1u; offset < uint(SORT_GROUP_SIZE); offset <<= 1 )
+    {
+        barrier();
+        uvec4 addLow = local >= offset ? scanLow[local - offset] : uvec4(0u);
+        uvec4 addHigh = local >= offset ? scanHigh[local - offset] : uvec4(0u);
+        barrier();
+        scanLow[local] += addLow;
+        scanHigh[local] += addHigh;
+    }
+    barrier();
+}
+
+// One of digit d in the packed layout above, for the low (base 0) or high (base 4) vector.
+// No arrays indexed by the digit, they'd end up in memory instead of registers
+uvec4 digitOne(uint d, uint base)
+{
+    return uvec4(equal(uvec4(d >> 1u), uvec4(base, base + 1u, base + 2u, base + 3u))) << ((d & 1u) * 16u);
+}
+
+uint digitCount(uvec4 low, uvec4 high, uint d)
+{
+    uvec4 counts = d < 8u ? low : high;
+    return (counts[(d >> 1u) & 3u] >> ((d & 1u) * 16u)) & 0xFFFFu;
+}
+
+void main() {
+    uint local = gl_LocalInvocationID.x;
+#if SORT_PASS == SORT_BOUNDS
+    // Each invocation's particles, then the work group's, then one atomic per corner
+    uint first = invocationIndex() * uint(SORT_PER_THREAD);
+    vec3 lo = vec3(3.0e38);
+    vec3 hi = vec3(-3.0e38);
+    for( uint k = 0u; k < uint(SORT_PER_THREAD) && first + k < particleCount; k++ )
+    {
+        vec3 p = particlePosition(first + k);
+        lo = min(lo, p);
+        hi = max(hi, p);
+    }
+    if( local < 6u )
+    {
+        groupExtent[local] = 0u;
+    }
+    barrier();
+    if( first < particleCount )
+    {
+        for( uint i = 0u; i < 3u; i++ )
+        {
+            atomicMax(groupExtent[i], orderedBits(hi[i]));
+            atomicMax(groupExtent[i + 3u], ~orderedBits(lo[i]));
+        }
+    }
+    barrier();
+    if( local < 3u )
+    {
+        atomicMax(extentMax[local], groupExtent[local]);
+    }
+    else if( local < 6u )
+    {
+        atomicMax(extentMin[local - 3u], groupExtent[local]);
+    }
+#elif SORT_PASS == SORT_KEYS
+    uint gid = invocationIndex();
+    if( gid < particleCount )
+    {
+        Keys[gid] = mortonKey(gid);
+        Indices[gid] = gid;
+    }
+#elif SORT_PASS == SORT_COUNT
+    uint group = workGroupIndex();
+    uint first = (group * uint(SORT_GROUP_SIZE) + local) * uint(SORT_PER_THREAD);
+    if( local < RADIX )
+    {
+        groupCounts[local] = 0u;
+    }
+    barrier();
+    for( uint k = 0u; k < uint(SORT_PER_THREAD) && first + k < particleCount; k++ )
+    {
+        atomicAdd(groupCounts[(Keys[first + k] >> shift) & (RADIX - 1u)], 1u);
+    }
+    barrier();
+    if( local < RADIX && group < groupCount )
+    {
+        DigitCounts[local * groupCount + group] = groupCounts[local];
+    }
+#elif SORT_PASS == SORT_SCAN
+    // Exclusive prefix sum of DigitCounts in place, a work group's worth at a time
+    uint total = 0u;
+    uint countSize = RADIX * groupCount;
+    for( uint base = 0u; base < countSize; base += uint(SORT_GROUP_SIZE) )
+    {
+        uint i = base + local;
+        uint value = i < countSize ? DigitCounts[i] : 0u;
+        scan[local] = value;
+        scanGroup();
+        if( i < countSize )
+        {
+            DigitCounts[i] = total + scan[local] - value;
+        }
+        total += scan[SORT_GROUP_SIZE - 1];
+        // Everyone has to have read scan[] before the next chunk overwrites it
+        barrier();
+    }
+#elif SORT_PASS == SORT_SCATTER
+    uint group = workGroupIndex();
+    uint first = (group * uint(SORT_GROUP_SIZE) + local) * uint(SORT_PER_THREAD);
+    uvec4 low = uvec4(0u);
+    uvec4 high = uvec4(0u);
+    for( uint k = 0u; k < uint(SORT_PER_THREAD) && first + k < particleCount; k++ )
+    {
+        uint d = (Keys[first + k] >> shift) & (RADIX - 1u);
+        low += digitOne(d, 0u);
+        high += digitOne(d, 4u);
+    }
+    scanLow[local] = low;
+    scanHigh[local] = high;
+    if( local < RADIX && group < groupCount )
+    {
+        groupCounts[local] = DigitCounts[local * groupCount + group];
+    }
+    scanDigits();
+    if( group >= groupCount )
+    {
+        return;
+    }
+    // How many of each digit come before this invocation's first in the work group,
+    //  counted up as its keys go out
+    low = scanLow[local] - low;
+    high = scanHigh[local] - high;
+    for( uint k = 0u; k < uint(SORT_PER_THREAD) && first + k < particleCount; k++ )
+    {
+        uint key = Keys[first + k];
+        uint d = (key >> shift) & (RADIX - 1u);
+        uint to = groupCounts[d] + digitCount(low, high, d);
+        SortedKeys[to] = key;
+        SortedIndices[to] = Indices[first + k];
+        low += digitOne(d, 0u);
+        high += digitOne(d, 4u);
+    }
+#elif SORT_PASS == SORT_GATHER
+    uint gid = invocationIndex();
+    if( gid < particleCount )
+    {
+        uint from = Indices[gid] * uint(SORT_WORDS);
+        for( uint w = 0u; w < uint(SORT_WORDS); w++ )
+        {
+            SortedWords[gid * uint(SORT_WORDS) + w] = UnsortedWords[from + w];
+        }
+    }
+#else
+    // The octree level below which particles 8i and 8i+1 are in different cells, 0 for
+    // the same smallest cell up to 10 for different halves of the cube
+    uint gid = invocationIndex() * 8u;
+    if( gid + 1u < particleCount )
+    {
+        uint level = uint(findMSB(mortonKey(gid) ^ mortonKey(gid + 1u)) + 3) / 3u;
+        atomicAdd(disorderSum, level);
+    }
+#endif
+}
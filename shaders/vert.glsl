@@ -3,26 +3,67 @@
 
 // Position, Velocity, Color SSBOs
 // Direct from the compute shader
-layout( std430, binding=4 ) buffer Pos
-{   vec4 Position[];  };  // array of structures
-layout( std430, binding=5 ) buffer Vel
-{   vec4 Velocity[];  };  // array of structures
-layout( std430, binding=6 ) buffer Col
-{   vec4 Color[];  };  // array of structures
+#include "particles.glsl"
+#ifdef COLOR_FROM_VELOCITY
+// No Col buffer in this mode, colors are looked up from the velocity instead.
+// Entry t of the table is the color at blend factor t, see common/ColorLUT.h
+layout( binding = 0 ) uniform sampler1D colorLUT;
+#endif
 
-uniform mat4 viewMat;
-uniform mat4 projMat;
-uniform float particleSizeScalar;
+#include "camera.glsl"
+
+#ifdef CULLED
+// Only the particles cull.glsl found on screen are drawn, vertex i is particle VisibleIndices[i]
+layout( std430, binding=7 ) readonly buffer Visible
+{   uint VisibleIndices[];  };
+uint particleID()
+{
+    return VisibleIndices[gl_VertexID];
+}
+#else
+uint particleID()
+{
+    return uint(gl_VertexID);
+}
+#endif
 
 out vec3 fragmentColor;
 
+#include "compact.glsl"
+
+#ifdef COMPACT_STORAGE
+vec4 particlePosition()
+{
+    return vec4(decodePosition(Positions[particleID()], compactBox), 1.0);
+}
+vec3 particleVelocity()
+{
+    return decodeVelocity(Velocities[particleID()]);
+}
+#else
+vec4 particlePosition()
+{
+    return Positions[particleID()];
+}
+vec3 particleVelocity()
+{
+    return Velocities[particleID()].xyz;
+}
+#endif
+
 void main() {
     // Set position accoring to VP matrices
-    gl_Position = projMat * viewMat * Position[gl_VertexID];
+    gl_Position = clipPosition(particlePosition());
     // Modify particle size to give a sense of depth
-    // A realistic model would divide by (z*z), but there are only so many pixels in a screen
-    gl_PointSize = particleSizeScalar/gl_Position.z;
+    gl_PointSize = pointSize(gl_Position);
 
+#ifdef COLOR_FROM_VELOCITY
+    // Same (1-e^(-kx)) curve as compute.glsl, the table does the blend
+    float scale = 1.0 - exp(-length(particleVelocity()) * colorScale);
+    // Aim for texel centers, so t = 0 and t = 1 land exactly on the end colors
+    fragmentColor = texture(colorLUT, (scale * (COLOR_LUT_SIZE - 1) + 0.5) / COLOR_LUT_SIZE).rgb;
+#else
     //forward color data on to fragment shader
-    fragmentColor = Color[gl_VertexID].xyz;
+    fragmentColor = Colors[particleID()].xyz;
+#endif
 }
\ No newline at end of file